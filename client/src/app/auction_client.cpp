@@ -1,9 +1,28 @@
 #include "auction_client.h"
 #include <iostream>
 
+namespace {
+
+ProductData ToProductData(const server::ProductInfo& product) {
+    ProductData data;
+    data.id = product.id();
+    data.display_id = product.display_id();
+    data.name = product.name();
+    data.initial_price_cents = product.initial_price_cents();
+    data.current_price_cents = product.current_price_cents();
+    data.seller = product.seller();
+    return data;
+}
+
+}  // namespace
+
 AuctionClient::AuctionClient(std::shared_ptr<Channel> channel)
     : stub_(server::Auction::NewStub(channel)) {}
 
+AuctionClient::~AuctionClient() {
+    StopWatch();
+}
+
 bool AuctionClient::RegisterUser(const std::string& nickname) {
     server::RegisterUserRequest request;
     request.set_nickname(nickname);
@@ -28,11 +47,11 @@ bool AuctionClient::RegisterUser(const std::string& nickname) {
     return true;
 }
 
-bool AuctionClient::AddProduct(const std::string& name, double initial_price, 
-                                const std::string& seller, std::string& out_product_id) {
+bool AuctionClient::AddProduct(const std::string& name, int64_t initial_price_cents, 
+                                const std::string& seller, std::string& out_display_id) {
     server::AddProductRequest request;
     request.set_name(name);
-    request.set_initial_price(initial_price);
+    request.set_initial_price_cents(initial_price_cents);
     request.set_seller(seller);
     
     server::AddProductResponse response;
@@ -51,15 +70,19 @@ bool AuctionClient::AddProduct(const std::string& name, double initial_price,
         return false;
     }
     
-    out_product_id = response.product_id();
+    out_display_id = response.display_id();
     last_error_.clear();
     return true;
 }
 
-std::vector<ProductData> AuctionClient::GetProducts() {
-    std::vector<ProductData> products;
+bool AuctionClient::GetProducts(const std::string& page_token, uint32_t page_size, uint64_t since_version,
+                                ProductPage& out_page) {
+    out_page = ProductPage();
     
     server::GetProductsRequest request;
+    request.set_page_size(page_size);
+    request.set_page_token(page_token);
+    request.set_since_version(since_version);
     server::GetProductsResponse response;
     ClientContext context;
     
@@ -68,28 +91,25 @@ std::vector<ProductData> AuctionClient::GetProducts() {
     if (!status.ok()) {
         last_error_ = "RPC failed: " + status.error_message();
         std::cerr << last_error_ << std::endl;
-        return products;
+        return false;
     }
     
     for (const auto& product : response.products()) {
-        ProductData data;
-        data.id = product.id();
-        data.name = product.name();
-        data.initial_price = product.initial_price();
-        data.current_price = product.current_price();
-        data.seller = product.seller();
-        products.push_back(data);
+        out_page.products.push_back(ToProductData(product));
     }
     
+    out_page.next_page_token = response.next_page_token();
+    out_page.catalog_version = response.catalog_version();
+    out_page.not_modified = response.not_modified();
     last_error_.clear();
-    return products;
+    return true;
 }
 
-bool AuctionClient::PlaceBid(const std::string& product_id, const std::string& bidder, double amount) {
+bool AuctionClient::PlaceBid(uint64_t product_id, const std::string& bidder, int64_t amount_cents) {
     server::PlaceBidRequest request;
     request.set_product_id(product_id);
     request.set_bidder(bidder);
-    request.set_amount(amount);
+    request.set_amount_cents(amount_cents);
     
     server::PlaceBidResponse response;
     ClientContext context;
@@ -109,4 +129,58 @@ bool AuctionClient::PlaceBid(const std::string& product_id, const std::string& b
     
     last_error_.clear();
     return true;
-}
\ No newline at end of file
+}
+void AuctionClient::StartWatch(uint64_t since_version) {
+    StopWatch();
+    {
+        std::lock_guard<std::mutex> lock(watch_mutex_);
+        watch_context_ = std::make_unique<ClientContext>();
+        watch_page_ = ProductPage();
+        watching_ = true;
+    }
+    watch_thread_ = std::thread(&AuctionClient::watchLoop, this, since_version);
+}
+
+void AuctionClient::StopWatch() {
+    {
+        std::lock_guard<std::mutex> lock(watch_mutex_);
+        if (watch_context_ != nullptr) {
+            watch_context_->TryCancel();
+        }
+    }
+    if (watch_thread_.joinable()) {
+        watch_thread_.join();
+    }
+}
+
+bool AuctionClient::PollWatch(ProductPage& out_page) {
+    std::lock_guard<std::mutex> lock(watch_mutex_);
+    out_page = std::move(watch_page_);
+    watch_page_ = ProductPage();
+    return watching_;
+}
+
+void AuctionClient::watchLoop(uint64_t since_version) {
+    server::WatchProductsRequest request;
+    request.set_since_version(since_version);
+    // Only StartWatch() replaces the context, after joining this thread.
+    std::unique_ptr<grpc::ClientReader<server::ProductUpdates>> reader =
+        stub_->WatchProducts(watch_context_.get(), request);
+    server::ProductUpdates updates;
+    while (reader->Read(&updates)) {
+        std::lock_guard<std::mutex> lock(watch_mutex_);
+        for (const auto& product : updates.products()) {
+            watch_page_.products.push_back(ToProductData(product));
+        }
+        if (updates.catalog_version() != 0) {
+            watch_page_.catalog_version = updates.catalog_version();
+        }
+    }
+    Status status = reader->Finish();
+    if (!status.ok() && status.error_code() != grpc::StatusCode::CANCELLED) {
+        std::cerr << "Product watch ended: " << status.error_message() << std::endl;
+    }
+    
+    std::lock_guard<std::mutex> lock(watch_mutex_);
+    watching_ = false;
+}
@@ -0,0 +1,46 @@
+#include "money.h"
+#include <cctype>
+#include <cstdint>
+#include <limits>
+
+bool ParseCents(const char* text, int64_t& out_cents) {
+    const char* p = text;
+    while (isspace(static_cast<unsigned char>(*p))) p++;
+    if (*p == '$') p++;
+    if (!isdigit(static_cast<unsigned char>(*p))) return false;
+    
+    int64_t whole = 0;
+    while (isdigit(static_cast<unsigned char>(*p))) {
+        if (whole > (std::numeric_limits<int64_t>::max() / 100 - 9) / 10) return false;
+        whole = whole * 10 + (*p - '0');
+        p++;
+    }
+    
+    int64_t fraction = 0;
+    if (*p == '.') {
+        p++;
+        int digits = 0;
+        while (isdigit(static_cast<unsigned char>(*p))) {
+            if (++digits > 2) return false;
+            fraction = fraction * 10 + (*p - '0');
+            p++;
+        }
+        if (digits == 1) fraction *= 10;
+    }
+    
+    while (isspace(static_cast<unsigned char>(*p))) p++;
+    if (*p != '\0') return false;
+    
+    out_cents = whole * 100 + fraction;
+    return true;
+}
+
+std::string FormatCents(int64_t cents) {
+    std::string text = cents < 0 ? "-" : "";
+    uint64_t magnitude = cents < 0 ? 0 - static_cast<uint64_t>(cents) : static_cast<uint64_t>(cents);
+    uint64_t fraction = magnitude % 100;
+    text += std::to_string(magnitude / 100);
+    text += fraction < 10 ? ".0" : ".";
+    text += std::to_string(fraction);
+    return text;
+}
@@ -1,8 +1,11 @@
 #ifndef AUCTION_CLIENT_H
 #define AUCTION_CLIENT_H
 
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <grpcpp/grpcpp.h>
 #include "../../server/build/e-space.grpc.pb.h"
@@ -12,27 +15,57 @@ using grpc::ClientContext;
 using grpc::Status;
 
 struct ProductData {
-    std::string id;
+    uint64_t id;
+    std::string display_id;
     std::string name;
-    double initial_price;
-    double current_price;
+    int64_t initial_price_cents;
+    int64_t current_price_cents;
     std::string seller;
 };
 
+struct ProductPage {
+    std::vector<ProductData> products;
+    std::string next_page_token;  // "" on the last page
+    uint64_t catalog_version = 0;
+    bool not_modified = false;
+};
+
 class AuctionClient {
 public:
     AuctionClient(std::shared_ptr<Channel> channel);
+    ~AuctionClient();
     
     bool RegisterUser(const std::string& nickname);
-    bool AddProduct(const std::string& name, double initial_price, const std::string& seller, std::string& out_product_id);
-    std::vector<ProductData> GetProducts();
-    bool PlaceBid(const std::string& product_id, const std::string& bidder, double amount);
+    bool AddProduct(const std::string& name, int64_t initial_price_cents, const std::string& seller, std::string& out_display_id);
+    // Up to page_size products in creation order, starting after the page
+    // that returned page_token ("" for the first page). With since_version,
+    // only products changed after that catalog version.
+    bool GetProducts(const std::string& page_token, uint32_t page_size, uint64_t since_version,
+                     ProductPage& out_page);
+    bool PlaceBid(uint64_t product_id, const std::string& bidder, int64_t amount_cents);
+    
+    // Streams the products changed after since_version on a background
+    // thread, replacing any stream already open.
+    void StartWatch(uint64_t since_version);
+    void StopWatch();
+    // Moves the changes received since the last call into out_page; its
+    // catalog_version stays 0 until a batch has arrived in full. Returns
+    // false once the stream has ended.
+    bool PollWatch(ProductPage& out_page);
     
     const std::string& GetLastError() const { return last_error_; }
     
 private:
+    void watchLoop(uint64_t since_version);
+    
     std::unique_ptr<server::Auction::Stub> stub_;
     std::string last_error_;
+    
+    std::thread watch_thread_;
+    std::mutex watch_mutex_;  // guards the members below
+    std::unique_ptr<ClientContext> watch_context_;
+    ProductPage watch_page_;
+    bool watching_ = false;
 };
 
 #endif // AUCTION_CLIENT_H
\ No newline at end of file
@@ -0,0 +1,17 @@
+#ifndef MONEY_H
+#define MONEY_H
+
+#include <cstdint>
+#include <string>
+
+// Prices travel as integer cents; these convert to and from what the user
+// types and sees, without going through floating point.
+
+// Parses "12", "12.3", "12.34" or "$12.34". Returns false on anything else,
+// including more than two decimals.
+bool ParseCents(const char* text, int64_t& out_cents);
+
+// 1234 -> "12.34"
+std::string FormatCents(int64_t cents);
+
+#endif // MONEY_H
@@ -1,14 +1,22 @@
 #include "app_config.h"
 #include "auction_client.h"
+#include "money.h"
 #include <SDL3/SDL_vulkan.h>
 #include <grpcpp/grpcpp.h>
+#include <algorithm>
 #include <cstring>
+#include <unordered_map>
 
 // Application state
 struct AppState {
     std::unique_ptr<AuctionClient> client;
     std::string current_user;
     std::vector<ProductData> products;
+    std::unordered_map<uint64_t, size_t> product_rows;  // product ID -> index in products
+    std::string next_page_token;
+    bool more_products;
+    bool products_stalled;  // a page failed to load; retried on the next sync
+    uint64_t catalog_version;
     bool is_registered;
     char nickname_input[64];
     char product_name_input[128];
@@ -18,9 +26,94 @@ struct AppState {
     std::string status_message;
     float status_timer;
     bool auto_refresh;
+    bool watching;  // a WatchProducts stream is open
     float refresh_timer;
 };
 
+// Products are fetched a page at a time, as the table is scrolled down.
+const uint32_t kProductsPageSize = 50;
+
+void AddProductRow(AppState& state, const ProductData& product) {
+    state.product_rows[product.id] = state.products.size();
+    state.products.push_back(product);
+}
+
+void LoadNextProductsPage(AppState& state) {
+    ProductPage page;
+    if (!state.client->GetProducts(state.next_page_token, kProductsPageSize, 0, page)) {
+        state.products_stalled = true;
+        return;
+    }
+    // Rows from later pages are at least as new as the first page's version.
+    if (state.products.empty()) {
+        state.catalog_version = page.catalog_version;
+    }
+    for (const auto& product : page.products) {
+        AddProductRow(state, product);
+    }
+    state.next_page_token = page.next_page_token;
+    state.more_products = !page.next_page_token.empty();
+}
+
+// Updates the rows already shown, and adds new products once the table has
+// been scrolled to the end. Products keep their rows, so the selection holds.
+void ApplyProductChanges(AppState& state, const ProductPage& page) {
+    for (const auto& product : page.products) {
+        auto row = state.product_rows.find(product.id);
+        if (row != state.product_rows.end()) {
+            state.products[row->second] = product;
+        } else if (!state.more_products) {
+            AddProductRow(state, product);
+        }
+    }
+    if (page.catalog_version != 0) {
+        state.catalog_version = page.catalog_version;
+    }
+}
+
+// Fetches only what changed since the last sync, usually nothing.
+void SyncProducts(AppState& state) {
+    state.products_stalled = false;
+    if (state.products.empty()) {
+        // Nothing listed yet: let the table fetch the first page again.
+        state.next_page_token.clear();
+        state.more_products = true;
+        return;
+    }
+    ProductPage page;
+    if (!state.client->GetProducts("", 0, state.catalog_version, page) || page.not_modified) {
+        return;
+    }
+    ApplyProductChanges(state, page);
+}
+
+// Applies what the watch stream has received. While it is down, syncs every
+// two seconds and reopens it from the version synced to.
+void UpdateProducts(AppState& state, ImGuiIO& io) {
+    if (!state.auto_refresh) {
+        if (state.watching) {
+            state.client->StopWatch();
+            state.watching = false;
+        }
+        return;
+    }
+    if (state.watching) {
+        ProductPage page;
+        state.watching = state.client->PollWatch(page);
+        ApplyProductChanges(state, page);
+        return;
+    }
+    state.refresh_timer += io.DeltaTime;
+    if (state.refresh_timer >= 2.0f) {
+        state.refresh_timer = 0.0f;
+        SyncProducts(state);
+        if (!state.products.empty()) {
+            state.client->StartWatch(state.catalog_version);
+            state.watching = true;
+        }
+    }
+}
+
 void ShowRegistrationWindow(AppState& state) {
     ImGui::Begin("User Registration");
     
@@ -62,10 +155,10 @@ void ShowAddProductWindow(AppState& state) {
     
     if (ImGui::Button("Add Product")) {
         if (strlen(state.product_name_input) > 0 && strlen(state.product_price_input) > 0) {
-            double price = atof(state.product_price_input);
-            if (price > 0) {
+            int64_t price_cents = 0;
+            if (ParseCents(state.product_price_input, price_cents) && price_cents > 0) {
                 std::string product_id;
-                if (state.client->AddProduct(state.product_name_input, price, state.current_user, product_id)) {
+                if (state.client->AddProduct(state.product_name_input, price_cents, state.current_user, product_id)) {
                     state.status_message = "Product added successfully! ID: " + product_id;
                     state.status_timer = 3.0f;
                     memset(state.product_name_input, 0, sizeof(state.product_name_input));
@@ -87,14 +180,15 @@ void ShowProductsWindow(AppState& state, ImGuiIO& io) {
     ImGui::Checkbox("Auto-refresh", &state.auto_refresh);
     ImGui::SameLine();
     if (ImGui::Button("Refresh Now")) {
-        state.products = state.client->GetProducts();
+        SyncProducts(state);
     }
     
     ImGui::Separator();
-    ImGui::Text("Products: %zu", state.products.size());
+    ImGui::Text("Products: %zu%s", state.products.size(), state.more_products ? "+" : "");
     ImGui::Separator();
     
-    if (ImGui::BeginTable("Products", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+    if (ImGui::BeginTable("Products", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY)) {
+        ImGui::TableSetupScrollFreeze(0, 1);
         ImGui::TableSetupColumn("Name");
         ImGui::TableSetupColumn("Seller");
         ImGui::TableSetupColumn("Initial Price");
@@ -102,41 +196,44 @@ void ShowProductsWindow(AppState& state, ImGuiIO& io) {
         ImGui::TableSetupColumn("Action");
         ImGui::TableHeadersRow();
         
-        for (int i = 0; i < (int)state.products.size(); i++) {
-            const auto& product = state.products[i];
-            ImGui::TableNextRow();
+        // Only the visible rows are laid out.
+        ImGuiListClipper clipper;
+        clipper.Begin((int)state.products.size());
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+                const auto& product = state.products[i];
+                ImGui::TableNextRow();
             
-            ImGui::TableNextColumn();
-            ImGui::Text("%s", product.name.c_str());
+                ImGui::TableNextColumn();
+                ImGui::Text("%s", product.name.c_str());
             
-            ImGui::TableNextColumn();
-            ImGui::Text("%s", product.seller.c_str());
+                ImGui::TableNextColumn();
+                ImGui::Text("%s", product.seller.c_str());
             
-            ImGui::TableNextColumn();
-            ImGui::Text("$%.2f", product.initial_price);
+                ImGui::TableNextColumn();
+                ImGui::Text("$%s", FormatCents(product.initial_price_cents).c_str());
             
-            ImGui::TableNextColumn();
-            ImGui::Text("$%.2f", product.current_price);
+                ImGui::TableNextColumn();
+                ImGui::Text("$%s", FormatCents(product.current_price_cents).c_str());
             
-            ImGui::TableNextColumn();
-            ImGui::PushID(i);
-            if (ImGui::Button("Select")) {
-                state.selected_product = i;
+                ImGui::TableNextColumn();
+                ImGui::PushID(i);
+                if (ImGui::Button("Select")) {
+                    state.selected_product = i;
+                }
+                ImGui::PopID();
             }
-            ImGui::PopID();
+        }
+        
+        // The last row is in view: fetch the next page.
+        if (state.more_products && !state.products_stalled && ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) {
+            LoadNextProductsPage(state);
         }
         
         ImGui::EndTable();
     }
     
-    // Auto-refresh logic
-    if (state.auto_refresh) {
-        state.refresh_timer += io.DeltaTime;
-        if (state.refresh_timer >= 2.0f) {
-            state.products = state.client->GetProducts();
-            state.refresh_timer = 0.0f;
-        }
-    }
+    UpdateProducts(state, io);
     
     ImGui::End();
 }
@@ -151,20 +248,23 @@ void ShowBiddingWindow(AppState& state) {
         
         ImGui::Text("Product: %s", product.name.c_str());
         ImGui::Text("Seller: %s", product.seller.c_str());
-        ImGui::Text("Current Price: $%.2f", product.current_price);
+        ImGui::Text("Current Price: $%s", FormatCents(product.current_price_cents).c_str());
         ImGui::Separator();
         
         ImGui::InputText("Bid Amount ($)", state.bid_amount_input, sizeof(state.bid_amount_input));
         
         if (ImGui::Button("Place Bid")) {
             if (strlen(state.bid_amount_input) > 0) {
-                double amount = atof(state.bid_amount_input);
-                if (amount > product.current_price) {
-                    if (state.client->PlaceBid(product.id, state.current_user, amount)) {
+                int64_t amount_cents = 0;
+                if (!ParseCents(state.bid_amount_input, amount_cents)) {
+                    state.status_message = "Enter an amount like 12.34";
+                    state.status_timer = 3.0f;
+                } else if (amount_cents > product.current_price_cents) {
+                    if (state.client->PlaceBid(product.id, state.current_user, amount_cents)) {
                         state.status_message = "Bid placed successfully!";
                         state.status_timer = 3.0f;
                         memset(state.bid_amount_input, 0, sizeof(state.bid_amount_input));
-                        state.products = state.client->GetProducts(); // Refresh
+                        SyncProducts(state);
                     } else {
                         state.status_message = "Failed to place bid: " + state.client->GetLastError();
                         state.status_timer = 3.0f;
@@ -248,10 +348,12 @@ int main(int, char**)
     appState.client = std::make_unique<AuctionClient>(
         grpc::CreateChannel("localhost:50051", grpc::InsecureChannelCredentials())
     );
+    appState.more_products = true;
     appState.is_registered = false;
     appState.selected_product = -1;
     appState.status_timer = 0.0f;
     appState.auto_refresh = true;
+    appState.watching = false;
     appState.refresh_timer = 0.0f;
     memset(appState.nickname_input, 0, sizeof(appState.nickname_input));
     memset(appState.product_name_input, 0, sizeof(appState.product_name_input));
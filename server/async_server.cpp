@@ -0,0 +1,174 @@
+#include "async_server.h"
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include "logger.h"
+
+using grpc::ServerAsyncResponseWriter;
+using grpc::ServerCompletionQueue;
+using server::Auction;
+
+namespace {
+
+// An armed or running unary call; its address is the completion queue tag.
+class Call {
+public:
+  virtual ~Call() = default;
+  // `rearm` is false once the server is shutting down, when no new call may
+  // be requested.
+  virtual void Proceed(bool ok, bool rearm) = 0;
+};
+
+template <typename Request, typename Response>
+class UnaryCall final : public Call {
+public:
+  using RequestMethod = void (Auction::AsyncService::*)(
+      ServerContext*, Request*, ServerAsyncResponseWriter<Response>*, grpc::CompletionQueue*,
+      ServerCompletionQueue*, void*);
+  using Handler = Status (AuctionService::*)(ServerContext*, const Request*, Response*);
+
+  // Asks for the next call of this method on `cq`. The object owns itself
+  // from here on and is deleted once its response is sent or the queue shuts
+  // down.
+  static void Arm(Auction::AsyncService& async_service, AuctionService& service,
+                  ServerCompletionQueue* cq, RequestMethod request, Handler handler) {
+    new UnaryCall(async_service, service, cq, request, handler);
+  }
+
+  void Proceed(bool ok, bool rearm) override {
+    if (finished_ || !ok) {
+      delete this;
+      return;
+    }
+    if (rearm) {
+      Arm(async_service_, service_, cq_, request_method_, handler_);
+    }
+    Status status = (service_.*handler_)(&context_, &request_, &response_);
+    finished_ = true;
+    responder_.Finish(response_, status, this);
+  }
+
+private:
+  UnaryCall(Auction::AsyncService& async_service, AuctionService& service,
+            ServerCompletionQueue* cq, RequestMethod request, Handler handler)
+      : async_service_(async_service), service_(service), cq_(cq),
+        request_method_(request), handler_(handler), responder_(&context_) {
+    (async_service_.*request_method_)(&context_, &request_, &responder_, cq_, cq_, this);
+  }
+
+  Auction::AsyncService& async_service_;
+  AuctionService& service_;
+  ServerCompletionQueue* const cq_;
+  const RequestMethod request_method_;
+  const Handler handler_;
+  ServerContext context_;
+  Request request_;
+  Response response_;
+  ServerAsyncResponseWriter<Response> responder_;
+  bool finished_ = false;
+};
+
+void PinToCore(std::thread& thread, unsigned core) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(core, &cpus);
+  if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) != 0) {
+    Log(LogLevel::kWarning, "Cannot pin completion queue thread to core {}", core);
+  }
+}
+
+}  // namespace
+
+AsyncAuctionServer::AsyncAuctionServer(AuctionService& service, AsyncServerOptions options)
+    : service_(service), options_(options), async_service_(service) {}
+
+AsyncAuctionServer::~AsyncAuctionServer() {
+  Shutdown();
+}
+
+void AsyncAuctionServer::Register(grpc::ServerBuilder& builder) {
+  builder.RegisterService(&async_service_);
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  int queues = options_.completion_queues > 0 ? options_.completion_queues
+                                              : static_cast<int>(cores);
+  for (int i = 0; i < queues; ++i) {
+    cqs_.push_back(builder.AddCompletionQueue());
+  }
+}
+
+void AsyncAuctionServer::Start() {
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  int threads = std::max(1, options_.threads_per_queue);
+  for (std::size_t i = 0; i < cqs_.size(); ++i) {
+    ServerCompletionQueue* cq = cqs_[i].get();
+    // One armed call per method per poller, so every poller can pick up work.
+    for (int t = 0; t < threads; ++t) {
+      UnaryCall<server::RegisterUserRequest, server::RegisterUserResponse>::Arm(
+          async_service_, service_, cq, &Auction::AsyncService::RequestRegisterUser,
+          &AuctionService::RegisterUser);
+      UnaryCall<server::AddProductRequest, server::AddProductResponse>::Arm(
+          async_service_, service_, cq, &Auction::AsyncService::RequestAddProduct,
+          &AuctionService::AddProduct);
+      UnaryCall<server::GetProductsRequest, server::GetProductsResponse>::Arm(
+          async_service_, service_, cq, &Auction::AsyncService::RequestGetProducts,
+          &AuctionService::GetProducts);
+      UnaryCall<server::PlaceBidRequest, server::PlaceBidResponse>::Arm(
+          async_service_, service_, cq, &Auction::AsyncService::RequestPlaceBid,
+          &AuctionService::PlaceBid);
+      UnaryCall<server::AddProductsRequest, server::AddProductsResponse>::Arm(
+          async_service_, service_, cq, &Auction::AsyncService::RequestAddProducts,
+          &AuctionService::AddProducts);
+      UnaryCall<server::PlaceBidsRequest, server::PlaceBidsResponse>::Arm(
+          async_service_, service_, cq, &Auction::AsyncService::RequestPlaceBids,
+          &AuctionService::PlaceBids);
+      UnaryCall<server::GetServerStatsRequest, server::GetServerStatsResponse>::Arm(
+          async_service_, service_, cq, &Auction::AsyncService::RequestGetServerStats,
+          &AuctionService::GetServerStats);
+      UnaryCall<server::DumpTraceRequest, server::DumpTraceResponse>::Arm(
+          async_service_, service_, cq, &Auction::AsyncService::RequestDumpTrace,
+          &AuctionService::DumpTrace);
+    }
+    for (int t = 0; t < threads; ++t) {
+      threads_.emplace_back(&AsyncAuctionServer::poll, this, cq);
+      if (options_.pin_threads) {
+        PinToCore(threads_.back(), static_cast<unsigned>(i % cores));
+      }
+    }
+  }
+}
+
+void AsyncAuctionServer::Shutdown() {
+  if (shut_down_) {
+    return;
+  }
+  shut_down_ = true;
+  {
+    std::unique_lock<std::shared_mutex> lock(rearm_mutex_);
+    stopping_ = true;
+  }
+  for (auto& cq : cqs_) {
+    cq->Shutdown();
+  }
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+  // Drains the queues if Start() was never called.
+  for (auto& cq : cqs_) {
+    void* tag;
+    bool ok;
+    while (cq->Next(&tag, &ok)) {
+      static_cast<Call*>(tag)->Proceed(false, false);
+    }
+  }
+}
+
+void AsyncAuctionServer::poll(ServerCompletionQueue* cq) {
+  void* tag;
+  bool ok;
+  while (cq->Next(&tag, &ok)) {
+    // Held across the handler so Shutdown() cannot close the queue between
+    // the check and the re-arm.
+    std::shared_lock<std::shared_mutex> lock(rearm_mutex_);
+    static_cast<Call*>(tag)->Proceed(ok, !stopping_);
+  }
+}
@@ -0,0 +1,85 @@
+#ifndef ASYNC_SERVER_H
+#define ASYNC_SERVER_H
+
+#include <memory>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+#include "auction_service.h"
+
+struct AsyncServerOptions {
+  // Completion queues, each with its own poller threads. 0 means one per core.
+  int completion_queues = 0;
+  int threads_per_queue = 1;
+  // Pin queue i's threads to core i % cores, so a queue's calls stay on one
+  // core's caches.
+  bool pin_threads = true;
+};
+
+// Serves AuctionService through the asynchronous API instead of gRPC's sync
+// thread pool. Every queue has one outstanding request per RPC per poller
+// thread; a poller that takes a call re-arms it and runs the handler inline.
+// Handlers block while their log record becomes durable, so with a synced
+// log raise threads_per_queue to keep enough bids in flight to batch.
+//
+// Usage: Register() on the builder, BuildAndStart(), Start(); Shutdown()
+// after the server's own Shutdown(). Shutdown() waits for running handlers.
+class AsyncAuctionServer {
+public:
+  AsyncAuctionServer(AuctionService& service, AsyncServerOptions options);
+  ~AsyncAuctionServer();
+
+  AsyncAuctionServer(const AsyncAuctionServer&) = delete;
+  AsyncAuctionServer& operator=(const AsyncAuctionServer&) = delete;
+
+  // Registers the async service and adds the completion queues.
+  void Register(grpc::ServerBuilder& builder);
+  // Arms the first calls and starts the poller threads.
+  void Start();
+  // Shuts the queues down and joins the pollers.
+  void Shutdown();
+
+private:
+  // The streaming methods are served through the callback API, as in the
+  // other modes.
+  class Service final
+      : public server::Auction::WithRawCallbackMethod_WatchProducts<
+            server::Auction::WithCallbackMethod_BidStream<
+                server::Auction::WithCallbackMethod_ImportProducts<
+                    server::Auction::AsyncService>>> {
+  public:
+    explicit Service(AuctionService& service) : service_(service) {}
+
+    grpc::ServerWriteReactor<grpc::ByteBuffer>* WatchProducts(
+        grpc::CallbackServerContext* context, const grpc::ByteBuffer* request) override {
+      return service_.WatchProducts(context, request);
+    }
+
+    grpc::ServerBidiReactor<server::BidStreamRequest, server::BidStreamResponse>* BidStream(
+        grpc::CallbackServerContext* context) override {
+      return service_.BidStream(context);
+    }
+
+    grpc::ServerReadReactor<server::ImportProductsRequest>* ImportProducts(
+        grpc::CallbackServerContext* context, server::ImportProductsResponse* response) override {
+      return service_.ImportProducts(context, response);
+    }
+
+  private:
+    AuctionService& service_;
+  };
+
+  void poll(grpc::ServerCompletionQueue* cq);
+
+  AuctionService& service_;
+  const AsyncServerOptions options_;
+  Service async_service_;
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+  std::vector<std::thread> threads_;
+  std::shared_mutex rearm_mutex_;
+  bool stopping_ = false;  // guarded by rearm_mutex_
+  bool shut_down_ = false;
+};
+
+#endif // ASYNC_SERVER_H
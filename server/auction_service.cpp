@@ -0,0 +1,1227 @@
+#include "auction_service.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "bid_stream.h"
+#include "logger.h"
+#include "product_feed.h"
+#include "product_import.h"
+#include "tracer.h"
+
+using server::RegisterUserRequest;
+using server::RegisterUserResponse;
+using server::AddProductRequest;
+using server::AddProductResponse;
+using server::GetProductsRequest;
+using server::GetProductsResponse;
+using server::ProductInfo;
+using server::PlaceBidRequest;
+using server::PlaceBidResponse;
+using server::AddProductsRequest;
+using server::AddProductsResponse;
+using server::PlaceBidsRequest;
+using server::PlaceBidsResponse;
+using server::ImportProductsRequest;
+using server::ImportProductsResponse;
+using server::GetServerStatsRequest;
+using server::GetServerStatsResponse;
+using server::DumpTraceRequest;
+using server::DumpTraceResponse;
+
+namespace {
+
+// How many products of a batch are filled in before they are logged and
+// listed. Catalog readers wait on a filled slot until it is listed, so this
+// bounds their wait, at the cost of locking each index shard once per chunk
+// rather than once per batch.
+constexpr std::size_t kPublishChunk = 256;
+
+// Heap bytes behind a string, 0 if it fits in the string object itself.
+std::size_t HeapBytes(const std::string& text) {
+  return text.capacity() > std::string().capacity() ? text.capacity() + 1 : 0;
+}
+
+}  // namespace
+
+NameHandle InternTable::Intern(std::string_view name) {
+  Shard<std::string_view, NameHandle>& shard =
+      handles_[shardIndex(name)];
+  {
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    if (const NameHandle* handle = shard.map.Find(name)) {
+      return *handle;
+    }
+  }
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  if (const NameHandle* handle = shard.map.Find(name)) {
+    return *handle;
+  }
+  NameHandle handle = entries_.Append();
+  if (handle == entries_.kFull) {
+    return kFull;
+  }
+  entries_[handle].name = std::string(name);
+  string_bytes_.fetch_add(HeapBytes(entries_[handle].name), std::memory_order_relaxed);
+  shard.map.TryEmplace(std::string_view(entries_[handle].name), handle);
+  shard.size.fetch_add(1, std::memory_order_relaxed);
+  return handle;
+}
+
+void InternTable::Restore(std::string_view name, bool present) {
+  NameHandle handle = entries_.Append();
+  if (handle == entries_.kFull || !present) {
+    return;
+  }
+  entries_[handle].name = std::string(name);
+  string_bytes_.fetch_add(HeapBytes(entries_[handle].name), std::memory_order_relaxed);
+  Shard<std::string_view, NameHandle>& shard =
+      handles_[shardIndex(name)];
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  if (shard.map.TryEmplace(std::string_view(entries_[handle].name), handle).second) {
+    shard.size.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+std::size_t InternTable::MemoryBytes() {
+  std::size_t bytes = entries_.MemoryBytes() + string_bytes_.load(std::memory_order_relaxed);
+  for (Shard<std::string_view, NameHandle>& shard : handles_) {
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    bytes += shard.map.MemoryBytes();
+  }
+  return bytes;
+}
+
+AuctionService::AuctionService(BidStrategy strategy)
+    : strategy_(strategy),
+      catalog_version_(static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::system_clock::now().time_since_epoch()).count())) {}
+
+void AuctionService::SetProductFeed(ProductFeed* feed) {
+  feed_ = feed;
+  track_changes_.store(feed != nullptr, std::memory_order_relaxed);
+}
+
+Status AuctionService::RegisterUser(ServerContext* context,
+                                    const RegisterUserRequest* request,
+                                    RegisterUserResponse* response) {
+  RpcTimer timer(RpcMethod::kRegisterUser);
+  TraceRequest trace("RegisterUser");
+  WriteAheadLog::Lsn durable_at;
+  ApplyRegisterUser(request, response, &durable_at);
+  timer.Mark(RpcPhase::kHandler);
+  return WaitDurable(durable_at, timer);
+}
+
+Status AuctionService::AddProduct(ServerContext* context,
+                                  const AddProductRequest* request,
+                                  AddProductResponse* response) {
+  RpcTimer timer(RpcMethod::kAddProduct);
+  TraceRequest trace("AddProduct");
+  WriteAheadLog::Lsn durable_at;
+  ApplyAddProduct(request, response, &durable_at);
+  timer.Mark(RpcPhase::kHandler);
+  return WaitDurable(durable_at, timer);
+}
+
+void AuctionService::ApplyRegisterUser(const RegisterUserRequest* request,
+                                       RegisterUserResponse* response,
+                                       WriteAheadLog::Lsn* durable_at) {
+  *durable_at = 0;
+  const std::string& nickname = request->nickname();
+  Log(LogLevel::kDebug, "User registration: {}", nickname);
+
+  if (insertUser(nickname)) {
+    std::string payload;
+    RecordWriter(payload).PutString(nickname);
+    *durable_at = logMutation(WalRecordType::kRegisterUser, payload);
+    Log(LogLevel::kInfo, "User successfully registered: {}", nickname);
+    response->set_success(true);
+  } else {
+    Log(LogLevel::kInfo, "User already exists: {}", nickname);
+    response->set_success(false);
+  }
+}
+
+void AuctionService::ApplyAddProduct(const AddProductRequest* request,
+                                     AddProductResponse* response,
+                                     WriteAheadLog::Lsn* durable_at) {
+  *durable_at = 0;
+  ProductId id = product_ids_.Next();
+  Cents initial_price = request->initial_price_cents() != 0
+                            ? request->initial_price_cents()
+                            : DollarsToCents(request->initial_price());
+
+  NameHandle seller = names_.Intern(request->seller());
+  Product* product = seller != InternTable::kFull
+                         ? fillProduct(id, request->name(), initial_price, seller)
+                         : nullptr;
+  if (product == nullptr) {
+    Log(LogLevel::kWarning, "Product table full, rejected: {}", request->name());
+    response->set_success(false);
+    return;
+  }
+
+  std::string payload;
+  RecordWriter writer(payload);
+  writer.PutU64(id);
+  writer.PutI64(initial_price);
+  writer.PutString(request->name());
+  writer.PutString(request->seller());
+  {
+    // Logged before it is listed: a bid on it can only be placed once it is
+    // listed, so the bid's record always follows the product's.
+    std::shared_lock<std::shared_mutex> publish_lock(publish_mutex_);
+    *durable_at = logMutation(WalRecordType::kAddProduct, payload);
+    listProducts(&product, 1);
+  }
+
+  Log(LogLevel::kInfo, "Product added by {}: {} (ID: {}) with initial price of {}",
+      request->seller(), request->name(), ProductIdText{id}, CentsText{initial_price});
+
+  response->set_success(true);
+  response->set_product_id(id);
+  response->set_display_id(FormatProductId(id));
+}
+
+Status AuctionService::GetProducts(ServerContext* context,
+                                   const GetProductsRequest* request,
+                                   GetProductsResponse* response) {
+  RpcTimer timer(RpcMethod::kGetProducts);
+  TraceRequest trace("GetProducts");
+  Status status = ListProducts(request, response);
+  trace.Set("products", static_cast<std::uint64_t>(response->products_size()));
+  timer.Finish();
+  return status;
+}
+
+Status AuctionService::ListProducts(const GetProductsRequest* request,
+                                    GetProductsResponse* response) {
+  // Read first: changes made after this are at worst listed again next time.
+  std::uint64_t version = catalog_version_.load(std::memory_order_acquire);
+  response->set_catalog_version(version);
+  // A newer version than ours comes from another run of the server.
+  std::uint64_t since = request->since_version() <= version ? request->since_version() : 0;
+  if (since == version) {
+    response->set_not_modified(true);
+    return Status::OK;
+  }
+
+  // The token is the ID of the previous page's last product, so a page
+  // resumes right after it however many products were added since.
+  std::uint32_t index = 0;
+  if (!request->page_token().empty()) {
+    const Product* last = findProduct(ParseProductId(request->page_token()));
+    if (last == nullptr) {
+      return Status(grpc::StatusCode::INVALID_ARGUMENT, "invalid page_token");
+    }
+    index = last->index + 1;
+  }
+  std::uint32_t end = products_.size();
+  std::uint32_t remaining = end > index ? end - index : 0;
+  std::uint32_t limit = request->page_size() == 0
+                            ? remaining
+                            : std::min({request->page_size(), kMaxPageSize, remaining});
+  Log(LogLevel::kDebug, "Products list requested, from slot {}, size: {}", index, limit);
+
+  // A since_version page lists only what changed, usually far below limit.
+  if (since == 0) {
+    response->mutable_products()->Reserve(static_cast<int>(limit));
+  }
+  const Product* last = nullptr;
+  std::uint32_t listed = 0;
+  for (; index < end && listed < limit; ++index) {
+    if (since != 0) {
+      index = product_changes_.NextChanged(index, end, since);
+      if (index == end) {
+        break;
+      }
+    }
+    const Product* product = listedProduct(index);
+    // A product still stamping a change counts as changed: that change's
+    // version may be below `version`, which the caller passes back next.
+    if (product != nullptr &&
+        (since == 0 || product->stamping.load(std::memory_order_acquire) != 0 ||
+         product->version.load(std::memory_order_acquire) > since)) {
+      fillProductInfo(*product, response->add_products());
+      last = product;
+      ++listed;
+    }
+  }
+  if (index < end && last != nullptr) {
+    response->set_next_page_token(std::to_string(last->id));
+  }
+  return Status::OK;
+}
+
+Status AuctionService::PlaceBid(ServerContext* context,
+                                const PlaceBidRequest* request,
+                                PlaceBidResponse* response) {
+  RpcTimer timer(RpcMethod::kPlaceBid);
+  TraceRequest trace("PlaceBid");
+  WriteAheadLog::Lsn durable_at;
+  ApplyPlaceBid(request, response, &durable_at);
+  timer.Mark(RpcPhase::kHandler);
+  return WaitDurable(durable_at, timer);
+}
+
+void AuctionService::ApplyPlaceBid(const PlaceBidRequest* request, PlaceBidResponse* response,
+                                   WriteAheadLog::Lsn* durable_at) {
+  *durable_at = 0;
+  ProductId product_id = request->product_id() != 0 ? request->product_id()
+                                                   : ParseProductId(request->display_id());
+  std::string_view bidder = request->bidder();
+  Cents amount = request->amount_cents() != 0 ? request->amount_cents()
+                                              : DollarsToCents(request->amount());
+
+  // Nothing below allocates once the bidder is interned, the journal
+  // segment exists and this thread has its log ring.
+  Log(LogLevel::kDebug, "{} placed bid of ${} for product {}", bidder, CentsText{amount},
+      ProductIdText{product_id});
+
+  Product* product;
+  {
+    TraceSpan span("find_product");
+    product = findProduct(product_id);
+  }
+  BidIndex bid = kNoBid;
+  if (product != nullptr) {
+    TraceSpan span("accept_bid");
+    bid = strategy_ == BidStrategy::kCompareAndSwap
+              ? placeBidCompareAndSwap(*product, bidder, amount)
+              : placeBidLocked(*product, bidder, amount);
+  }
+
+  if (bid != kNoBid) {
+    touchProduct(*product);
+    bid_counts_[shardIndex(product_id)].value.fetch_add(1, std::memory_order_relaxed);
+    RpcStats::Count(RpcCounter::kBidsAccepted);
+    {
+      TraceSpan span("wal_append");
+      // Reused so that, once warm, encoding the record does not allocate.
+      thread_local std::string payload;
+      payload.clear();
+      encodeBid(product_id, amount, journal_[bid].placed_at, bid, bidder, payload);
+      *durable_at = logMutation(WalRecordType::kPlaceBid, payload);
+    }
+    TraceSpan span("log");
+    Log(LogLevel::kInfo, "Bid placed successfully for product {} new price: {}",
+        ProductIdText{product_id}, CentsText{amount});
+    response->set_success(true);
+  } else {
+    RpcStats::Count(RpcCounter::kBidsRejected);
+    TraceSpan span("log");
+    Log(LogLevel::kInfo, "Bid failed for product {} amount: {}", ProductIdText{product_id},
+        CentsText{amount});
+    response->set_success(false);
+  }
+}
+
+Status AuctionService::AddProducts(ServerContext* context,
+                                   const AddProductsRequest* request,
+                                   AddProductsResponse* response) {
+  RpcTimer timer(RpcMethod::kAddProducts);
+  TraceRequest trace("AddProducts");
+  WriteAheadLog::Lsn durable_at;
+  Status status = ApplyAddProducts(request, response, &durable_at);
+  timer.Mark(RpcPhase::kHandler);
+  if (!status.ok()) {
+    timer.Finish();
+    return status;
+  }
+  return WaitDurable(durable_at, timer);
+}
+
+Status AuctionService::ApplyAddProducts(const AddProductsRequest* request,
+                                        AddProductsResponse* response,
+                                        WriteAheadLog::Lsn* durable_at) {
+  *durable_at = 0;
+  if (request->products_size() > kMaxBatchSize) {
+    return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                  "at most " + std::to_string(kMaxBatchSize) + " products per call");
+  }
+  Log(LogLevel::kDebug, "Batch of {} products received", request->products_size());
+
+  std::vector<ProductId> ids(static_cast<std::size_t>(request->products_size()));
+  *durable_at = addProducts(request->products(), ids.data());
+  std::size_t added = 0;
+  response->mutable_results()->Reserve(request->products_size());
+  for (ProductId id : ids) {
+    AddProductResponse* result = response->add_results();
+    result->set_success(id != 0);
+    if (id != 0) {
+      result->set_product_id(id);
+      result->set_display_id(FormatProductId(id));
+      ++added;
+    }
+  }
+  Log(LogLevel::kInfo, "Batch of {} products added, {} rejected", added, ids.size() - added);
+  return Status::OK;
+}
+
+Status AuctionService::ApplyImportChunk(const ImportProductsRequest* request, ProductId* ids,
+                                        WriteAheadLog::Lsn* durable_at) {
+  *durable_at = 0;
+  if (request->products_size() > kMaxBatchSize) {
+    return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                  "at most " + std::to_string(kMaxBatchSize) + " products per chunk");
+  }
+  Log(LogLevel::kDebug, "Import chunk of {} products received", request->products_size());
+  *durable_at = addProducts(request->products(), ids);
+  return Status::OK;
+}
+
+WriteAheadLog::Lsn AuctionService::addProducts(
+    const google::protobuf::RepeatedPtrField<AddProductRequest>& items, ProductId* ids) {
+  WriteAheadLog::Lsn durable_at = 0;
+  std::vector<Product*> filled;
+  filled.reserve(std::min(static_cast<std::size_t>(items.size()), kPublishChunk));
+  std::vector<std::string> payloads;
+  payloads.reserve(filled.capacity());
+  // Logs and lists what has been filled in, as ApplyAddProduct() does.
+  auto publish = [&] {
+    if (filled.empty()) {
+      return;
+    }
+    std::shared_lock<std::shared_mutex> publish_lock(publish_mutex_);
+    {
+      TraceSpan span("wal_append");
+      durable_at = logMutations(WalRecordType::kAddProduct, payloads);
+    }
+    TraceSpan span("list_products");
+    listProducts(filled.data(), filled.size());
+    filled.clear();
+    payloads.clear();
+  };
+
+  NameHandle seller = InternTable::kFull;
+  const std::string* seller_name = nullptr;
+  for (int i = 0; i < items.size(); ++i) {
+    const AddProductRequest& item = items[i];
+    Cents initial_price = item.initial_price_cents() != 0 ? item.initial_price_cents()
+                                                          : DollarsToCents(item.initial_price());
+    // Uploads usually list one seller's products together.
+    if (seller_name == nullptr || item.seller() != *seller_name) {
+      seller = names_.Intern(item.seller());
+      seller_name = &item.seller();
+    }
+    ProductId id = product_ids_.Next();
+    Product* product = seller != InternTable::kFull
+                           ? fillProduct(id, item.name(), initial_price, seller)
+                           : nullptr;
+    if (product == nullptr) {
+      Log(LogLevel::kWarning, "Product table full, rejected: {}", item.name());
+      ids[i] = 0;
+      continue;
+    }
+    ids[i] = id;
+    filled.push_back(product);
+    RecordWriter writer(payloads.emplace_back());
+    writer.PutU64(id);
+    writer.PutI64(initial_price);
+    writer.PutString(item.name());
+    writer.PutString(item.seller());
+    if (filled.size() == kPublishChunk) {
+      publish();
+    }
+  }
+  publish();
+  return durable_at;
+}
+
+Status AuctionService::PlaceBids(ServerContext* context,
+                                 const PlaceBidsRequest* request,
+                                 PlaceBidsResponse* response) {
+  RpcTimer timer(RpcMethod::kPlaceBids);
+  TraceRequest trace("PlaceBids");
+  WriteAheadLog::Lsn durable_at;
+  Status status = ApplyPlaceBids(request, response, &durable_at);
+  timer.Mark(RpcPhase::kHandler);
+  if (!status.ok()) {
+    timer.Finish();
+    return status;
+  }
+  return WaitDurable(durable_at, timer);
+}
+
+Status AuctionService::ApplyPlaceBids(const PlaceBidsRequest* request,
+                                      PlaceBidsResponse* response,
+                                      WriteAheadLog::Lsn* durable_at) {
+  *durable_at = 0;
+  int count = request->bids_size();
+  if (count > kMaxBatchSize) {
+    return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                  "at most " + std::to_string(kMaxBatchSize) + " bids per call");
+  }
+  Log(LogLevel::kDebug, "Batch of {} bids received", count);
+
+  // Sorted by product, then by position in the request, so each product is
+  // looked up, locked and stamped once, and gets its bids in request order.
+  std::vector<std::pair<ProductId, int>> order;
+  order.reserve(static_cast<std::size_t>(count));
+  for (int i = 0; i < count; ++i) {
+    const PlaceBidRequest& bid = request->bids(i);
+    order.emplace_back(bid.product_id() != 0 ? bid.product_id() : ParseProductId(bid.display_id()),
+                       i);
+    response->add_results()->set_success(false);
+  }
+  std::sort(order.begin(), order.end());
+
+  struct Accepted {
+    int position;  // in the request
+    BidIndex bid;
+    Cents amount;
+  };
+  std::vector<Accepted> accepted;
+  std::vector<std::string> payloads;
+  for (std::size_t start = 0, end; start < order.size(); start = end) {
+    ProductId product_id = order[start].first;
+    end = start + 1;
+    while (end < order.size() && order[end].first == product_id) {
+      ++end;
+    }
+    Product* product;
+    {
+      TraceSpan span("find_product");
+      product = findProduct(product_id);
+    }
+    if (product == nullptr) {
+      continue;
+    }
+
+    // Only the bids are placed under the lock; their records are encoded
+    // once it is released.
+    accepted.clear();
+    {
+      TraceSpan span("accept_bids");
+      std::unique_lock<std::mutex> bid_lock;
+      if (strategy_ == BidStrategy::kProductLock) {
+        bid_lock = lockBids(*product, RpcMethod::kPlaceBids);
+      }
+      for (std::size_t i = start; i < end; ++i) {
+        const PlaceBidRequest& bid = request->bids(order[i].second);
+        Cents amount = bid.amount_cents() != 0 ? bid.amount_cents() : DollarsToCents(bid.amount());
+        BidIndex placed = bid_lock.owns_lock()
+                              ? acceptBidLocked(*product, bid.bidder(), amount)
+                              : placeBidCompareAndSwap(*product, bid.bidder(), amount);
+        if (placed != kNoBid) {
+          accepted.push_back({order[i].second, placed, amount});
+        }
+      }
+    }
+    if (accepted.empty()) {
+      continue;
+    }
+    touchProduct(*product);
+    bid_counts_[shardIndex(product_id)].value.fetch_add(accepted.size(),
+                                                        std::memory_order_relaxed);
+    for (const Accepted& bid : accepted) {
+      encodeBid(product_id, bid.amount, journal_[bid.bid].placed_at, bid.bid,
+                request->bids(bid.position).bidder(), payloads.emplace_back());
+      response->mutable_results(bid.position)->set_success(true);
+    }
+  }
+  RpcStats::Count(RpcCounter::kBidsAccepted, payloads.size());
+  RpcStats::Count(RpcCounter::kBidsRejected, order.size() - payloads.size());
+  {
+    TraceSpan span("wal_append");
+    *durable_at = logMutations(WalRecordType::kPlaceBid, payloads);
+  }
+  Log(LogLevel::kInfo, "Batch of {} bids placed, {} rejected", payloads.size(),
+      order.size() - payloads.size());
+  return Status::OK;
+}
+
+grpc::ServerWriteReactor<grpc::ByteBuffer>* AuctionService::WatchProducts(
+    grpc::CallbackServerContext* context, const grpc::ByteBuffer* request) {
+  if (feed_ == nullptr) {
+    return ProductFeed::Reject(
+        Status(grpc::StatusCode::UNIMPLEMENTED, "product feed not enabled"));
+  }
+  return feed_->Watch(context, request);
+}
+
+grpc::ServerBidiReactor<server::BidStreamRequest, server::BidStreamResponse>*
+AuctionService::BidStream(grpc::CallbackServerContext* context) {
+  return StartBidStream(*this);
+}
+
+grpc::ServerReadReactor<ImportProductsRequest>* AuctionService::ImportProducts(
+    grpc::CallbackServerContext* context, ImportProductsResponse* response) {
+  return StartProductImport(*this, response);
+}
+
+Status AuctionService::GetServerStats(ServerContext* context,
+                                      const GetServerStatsRequest* request,
+                                      GetServerStatsResponse* response) {
+  RpcTimer timer(RpcMethod::kGetServerStats);
+  for (int method = 0; method < kRpcMethodCount; ++method) {
+    for (int phase = 0; phase < kRpcPhaseCount; ++phase) {
+      LatencyCounts counts = RpcStats::Latency(static_cast<RpcMethod>(method),
+                                               static_cast<RpcPhase>(phase));
+      if (counts.count() == 0) {
+        continue;
+      }
+      server::LatencyStats* stats = response->add_latencies();
+      stats->set_method(RpcMethodName(static_cast<RpcMethod>(method)));
+      stats->set_phase(RpcPhaseName(static_cast<RpcPhase>(phase)));
+      stats->set_count(counts.count());
+      stats->set_mean_ns(counts.Mean());
+      stats->set_p50_ns(counts.Percentile(0.5));
+      stats->set_p90_ns(counts.Percentile(0.9));
+      stats->set_p99_ns(counts.Percentile(0.99));
+      stats->set_p999_ns(counts.Percentile(0.999));
+      stats->set_max_ns(counts.max());
+    }
+  }
+  response->set_bids_accepted(RpcStats::Total(RpcCounter::kBidsAccepted));
+  response->set_bids_rejected(RpcStats::Total(RpcCounter::kBidsRejected));
+  response->set_bid_retries(RpcStats::Total(RpcCounter::kBidRetries));
+
+  response->set_products(ProductCount());
+  response->set_users(UserCount());
+  response->set_names(names_.size());
+  response->set_bids(BidCount());
+  response->set_bid_records(journal_.size());
+
+  std::size_t product_bytes =
+      products_.MemoryBytes() + product_changes_.MemoryBytes() +
+      product_name_bytes_.load(std::memory_order_relaxed);
+  for (Shard<ProductId, std::uint32_t>& shard : product_index_) {
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    product_bytes += shard.map.MemoryBytes();
+  }
+  response->set_product_memory_bytes(product_bytes);
+  response->set_name_memory_bytes(names_.MemoryBytes());
+  response->set_bid_memory_bytes(journal_.MemoryBytes());
+  response->set_log_lines_dropped(Logger::Dropped());
+  response->set_watchers(feed_ != nullptr ? feed_->WatcherCount() : 0);
+  response->set_products_imported(RpcStats::Total(RpcCounter::kProductsImported));
+  timer.Finish();
+  return Status::OK;
+}
+
+Status AuctionService::DumpTrace(ServerContext* context, const DumpTraceRequest* request,
+                                 DumpTraceResponse* response) {
+  RpcTimer timer(RpcMethod::kDumpTrace);
+  std::string path;
+  std::size_t spans = 0;
+  std::string error;
+  if (!Tracer::Enabled()) {
+    response->set_success(false);
+    response->set_error("tracing is off; start the server with --trace-sample=N");
+  } else if (!Tracer::Dump(&path, &spans, &error)) {
+    Log(LogLevel::kWarning, "Trace dump failed: {}", error);
+    response->set_success(false);
+    response->set_error(error);
+  } else {
+    Log(LogLevel::kInfo, "Trace written to {}: {} spans", path, spans);
+    response->set_success(true);
+    response->set_path(path);
+    response->set_spans(spans);
+  }
+  timer.Finish();
+  return Status::OK;
+}
+
+bool AuctionService::LoadSnapshot(const std::string& path, WriteAheadLog::Position* wal_start,
+                                  std::string* error) {
+  *wal_start = WriteAheadLog::Position();
+  auto started = std::chrono::steady_clock::now();
+  auto snapshot = std::make_unique<SnapshotFile>();
+  if (!snapshot->Open(path, error)) {
+    return false;
+  }
+  if (!snapshot->loaded()) {
+    return true;
+  }
+  const SnapshotHeader& header = snapshot->header();
+
+  const SnapshotString* names = snapshot->Section<const SnapshotString>(header.names);
+  for (std::uint64_t i = 0; i < header.names.count; ++i) {
+    names_.Restore(snapshot->String(names[i]), SnapshotFile::Has(names[i]));
+  }
+
+  const NameHandle* users = snapshot->Section<const NameHandle>(header.users);
+  for (std::uint64_t i = 0; i < header.users.count; ++i) {
+    if (users[i] < header.names.count &&
+        names_.SetFlag(users[i], InternTable::kRegisteredUser)) {
+      user_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  for (Shard<ProductId, std::uint32_t>& shard : product_index_) {
+    shard.map.Reserve(header.products.count / kShardCount + 1);
+  }
+  const SnapshotProduct* products = snapshot->Section<const SnapshotProduct>(header.products);
+  for (std::uint64_t i = 0; i < header.products.count; ++i) {
+    const SnapshotProduct& entry = products[i];
+    if (entry.id == 0) {
+      // A product that was being added while the snapshot was taken; its
+      // slot is kept so later indexes line up, and replay adds it anew.
+      std::uint32_t index = products_.Append();
+      if (index != products_.kFull) {
+        products_[index].slot.store(ProductSlot::kEmpty, std::memory_order_relaxed);
+      }
+      continue;
+    }
+    Product* product =
+        entry.seller < header.names.count
+            ? insertProduct(entry.id, std::string(snapshot->String(entry.name)),
+                            entry.initial_price, entry.seller)
+            : nullptr;
+    if (product == nullptr) {
+      *error = "snapshot product " + FormatProductId(entry.id) + " cannot be restored";
+      return false;
+    }
+    product->top_bid.store(entry.top_bid, std::memory_order_relaxed);
+    bid_counts_[shardIndex(entry.id)].value.fetch_add(entry.bid_count,
+                                                      std::memory_order_relaxed);
+    product_ids_.AdvancePast(entry.id);
+  }
+
+  snapshot_bids_ = static_cast<BidIndex>(header.bids.count);
+  journal_.Adopt(snapshot->Section<BidRecord>(header.bids), snapshot_bids_);
+  wal_start->segment = header.wal_segment;
+  wal_start->offset = header.wal_offset;
+  snapshot_ = std::move(snapshot);
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - started);
+  Log(LogLevel::kInfo, "Loaded snapshot {}: {} products, {} bid records in {} ms", path,
+      header.products.count, header.bids.count, elapsed.count());
+  return true;
+}
+
+bool AuctionService::Recover(const std::string& wal_dir, const WriteAheadLog::Position& start,
+                             std::string* error) {
+  std::size_t records = 0;
+  std::size_t skipped = 0;
+  bool ok = WriteAheadLog::Replay(
+      wal_dir, start,
+      [&](WalRecordType type, std::string_view payload) {
+        RecordReader reader(payload);
+        std::string_view name;
+        std::string_view seller;
+        std::uint64_t id;
+        std::int64_t amount;
+        std::uint32_t placed_at;
+        std::uint32_t bid;
+        NameHandle seller_handle;
+        bool applied = false;
+        switch (type) {
+          case WalRecordType::kRegisterUser:
+            // Registering an existing user is a no-op, as in RegisterUser.
+            applied = reader.GetString(name);
+            if (applied) {
+              insertUser(name);
+            }
+            break;
+          case WalRecordType::kAddProduct:
+            applied = reader.GetU64(id) && reader.GetI64(amount) && reader.GetString(name) &&
+                      reader.GetString(seller);
+            if (applied && findProduct(id) == nullptr) {
+              seller_handle = names_.Intern(seller);
+              applied = seller_handle != InternTable::kFull &&
+                        insertProduct(id, std::string(name), amount, seller_handle) != nullptr;
+            }
+            if (applied) {
+              product_ids_.AdvancePast(id);
+            }
+            break;
+          case WalRecordType::kPlaceBid:
+            applied = reader.GetU64(id) && reader.GetI64(amount) && reader.GetU32(placed_at) &&
+                      reader.GetU32(bid) && reader.GetString(name);
+            // The snapshot may already hold bids logged after its offset:
+            // those are the records it kept linked rather than void.
+            if (applied && (bid >= snapshot_bids_ || journal_[bid].previous == kVoidBid)) {
+              applied = replayBid(id, name, amount, placed_at);
+            }
+            break;
+        }
+        ++records;
+        skipped += !applied;
+      },
+      error);
+  if (ok) {
+    if (skipped != 0) {
+      Log(LogLevel::kWarning, "Recovered {} log records from {} ({} could not be applied)",
+          records, wal_dir, skipped);
+    } else {
+      Log(LogLevel::kInfo, "Recovered {} log records from {}", records, wal_dir);
+    }
+  }
+  return ok;
+}
+
+// Every mutation but a new product is applied in memory before it is
+// logged, and a new product is listed under publish_mutex_ once logged, so
+// reading the log tail under that lock first guarantees the state captured
+// afterwards holds everything logged before that offset. It may also hold
+// some later mutations; the snapshot keeps them consistent so Recover()
+// can skip them:
+//  - users and products are keyed, and replaying them again is a no-op;
+//  - a bid is kept only if it and every bid below it in its chain were
+//    appended before the cut. Other records below the cut are written void,
+//    which tells Recover() to replay them.
+bool AuctionService::WriteSnapshot(const std::string& path, RateLimiter* limiter,
+                                   WriteAheadLog::Position* covered, std::string* error) {
+  std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+  auto started = std::chrono::steady_clock::now();
+
+  WriteAheadLog::Position tail;
+  if (wal_ != nullptr) {
+    std::unique_lock<std::shared_mutex> publish_lock(publish_mutex_);
+    tail = wal_->Tail();
+  }
+  BidIndex bid_count = journal_.size();
+  std::uint32_t product_slots = products_.size();
+  NameHandle name_count = names_.size();
+
+  // Only names something in the snapshot refers to are written: those are
+  // the ones known to be fully added.
+  std::vector<bool> name_used(name_count);
+  std::vector<NameHandle> users;
+  for (NameHandle handle = 0; handle < name_count; ++handle) {
+    if (names_.HasFlag(handle, InternTable::kRegisteredUser)) {
+      users.push_back(handle);
+      name_used[handle] = true;
+    }
+  }
+
+  SnapshotStrings strings;
+  SnapshotProduct empty{};
+  empty.top_bid = kNoBid;
+  std::vector<SnapshotProduct> products(product_slots, empty);
+  for (Shard<ProductId, std::uint32_t>& shard : product_index_) {
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    shard.map.ForEach([&](ProductId, std::uint32_t index) {
+      if (index >= product_slots) {
+        return;
+      }
+      const Product& product = products_[index];
+      SnapshotProduct& out = products[index];
+      out.id = product.id;
+      out.initial_price = product.initial_price;
+      out.name = strings.Add(product.name);
+      out.seller = product.seller;
+      out.top_bid = product.top_bid.load(std::memory_order_acquire);
+    });
+  }
+
+  std::vector<bool> kept(bid_count);
+  for (SnapshotProduct& product : products) {
+    if (product.id == 0) {
+      continue;
+    }
+    if (product.seller < name_count) {
+      name_used[product.seller] = true;
+    }
+    // The snapshot's head is the top of the chain's longest suffix that
+    // lies entirely below the cut.
+    BidIndex head = kNoBid;
+    bool restart = true;
+    journal_.ForEachInChain(product.top_bid, [&](BidIndex index, const BidRecord&) {
+      if (index >= bid_count) {
+        restart = true;
+      } else if (restart) {
+        head = index;
+        restart = false;
+      }
+    });
+    product.top_bid = head;
+    journal_.ForEachInChain(head, [&](BidIndex index, const BidRecord& record) {
+      kept[index] = true;
+      if (record.bidder < name_count) {
+        name_used[record.bidder] = true;
+      }
+      ++product.bid_count;
+    });
+  }
+
+  std::vector<SnapshotString> names(name_count);
+  for (NameHandle handle = 0; handle < name_count; ++handle) {
+    if (name_used[handle]) {
+      names[handle] = strings.Add(names_.Name(handle));
+    }
+  }
+
+  SnapshotWriter writer(path);
+  if (!writer.Open(error)) {
+    return false;
+  }
+  writer.SetRateLimiter(limiter);
+  SnapshotHeader header{};
+  header.wal_segment = tail.segment;
+  header.wal_offset = tail.offset;
+
+  writer.BeginSection(alignof(NameHandle));
+  writer.Write(users.data(), users.size() * sizeof(NameHandle));
+  header.users = writer.EndSection(users.size());
+
+  writer.BeginSection(alignof(SnapshotProduct));
+  writer.Write(products.data(), products.size() * sizeof(SnapshotProduct));
+  header.products = writer.EndSection(products.size());
+
+  writer.BeginSection(alignof(SnapshotString));
+  writer.Write(names.data(), names.size() * sizeof(SnapshotString));
+  header.names = writer.EndSection(names.size());
+
+  // Page aligned so the journal can point straight into the mapping.
+  writer.BeginSection(4096);
+  BidRecord void_record{};
+  void_record.previous = kVoidBid;
+  std::vector<BidRecord> chunk;
+  chunk.reserve(4096);
+  for (BidIndex index = 0; index < bid_count; ++index) {
+    chunk.push_back(kept[index] ? journal_[index] : void_record);
+    if (chunk.size() == chunk.capacity()) {
+      writer.Write(chunk.data(), chunk.size() * sizeof(BidRecord));
+      chunk.clear();
+    }
+  }
+  writer.Write(chunk.data(), chunk.size() * sizeof(BidRecord));
+  header.bids = writer.EndSection(bid_count);
+
+  writer.BeginSection(1);
+  writer.Write(strings.data().data(), strings.data().size());
+  header.strings = writer.EndSection(strings.data().size());
+
+  // The snapshot must not cover log records that a crash could still lose.
+  if (wal_ != nullptr && (!wal_->WaitDurable(tail.lsn) || !wal_->Sync())) {
+    *error = "write-ahead log failed before the snapshot was complete";
+    return false;
+  }
+  if (!writer.Commit(header, error)) {
+    return false;
+  }
+  if (covered != nullptr) {
+    *covered = tail;
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - started);
+  Log(LogLevel::kInfo, "Snapshot written to {}: {} products, {} bid records, {} bytes in {} ms",
+      path, products.size(), bid_count, writer.bytes(), elapsed.count());
+  return true;
+}
+
+bool AuctionService::insertUser(std::string_view nickname) {
+  NameHandle handle = names_.Intern(nickname);
+  if (handle == InternTable::kFull || !names_.SetFlag(handle, InternTable::kRegisteredUser)) {
+    return false;
+  }
+  user_count_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+Product* AuctionService::insertProduct(ProductId id, const std::string& name,
+                                       Cents initial_price, NameHandle seller) {
+  Product* product = fillProduct(id, name, initial_price, seller);
+  if (product != nullptr) {
+    listProducts(&product, 1);
+  }
+  return product;
+}
+
+Product* AuctionService::fillProduct(ProductId id, const std::string& name,
+                                     Cents initial_price, NameHandle seller) {
+  std::uint32_t index = products_.Append();
+  if (index == products_.kFull) {
+    return nullptr;
+  }
+  // Filled in before the index is published under the shard lock.
+  Product& product = products_[index];
+  product.id = id;
+  product.index = index;
+  product.name = name;
+  product_name_bytes_.fetch_add(HeapBytes(product.name), std::memory_order_relaxed);
+  product.initial_price = initial_price;
+  product.seller = seller;
+  return &product;
+}
+
+void AuctionService::listProducts(Product** products, std::size_t count) {
+  std::sort(products, products + count, [](const Product* a, const Product* b) {
+    return shardIndex(a->id) < shardIndex(b->id);
+  });
+  for (std::size_t start = 0, end; start < count; start = end) {
+    std::size_t shard_index = shardIndex(products[start]->id);
+    end = start + 1;
+    while (end < count && shardIndex(products[end]->id) == shard_index) {
+      ++end;
+    }
+    Shard<ProductId, std::uint32_t>& shard = product_index_[shard_index];
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    for (std::size_t i = start; i < end; ++i) {
+      Product& product = *products[i];
+      shard.map.TryEmplace(product.id, product.index);
+      touchProduct(product);
+      product.slot.store(ProductSlot::kListed, std::memory_order_release);
+    }
+    shard.size.fetch_add(end - start, std::memory_order_relaxed);
+  }
+}
+
+void AuctionService::touchProduct(Product& product) {
+  // Raised before the catalog version moves on, so a reader that sees the
+  // new version also sees `stamping` until version below is stored.
+  product.stamping.fetch_add(1, std::memory_order_relaxed);
+  product_changes_.BeginChange(product.index);
+  // Queued before the version moves on too, so that once the feed reads a
+  // version, every change up to it is either queued or already taken.
+  if (track_changes_.load(std::memory_order_relaxed) &&
+      !product.queued.exchange(true, std::memory_order_acq_rel)) {
+    std::lock_guard<std::mutex> lock(changed_mutex_);
+    changed_.push_back(product.index);
+  }
+  std::uint64_t version = catalog_version_.fetch_add(1, std::memory_order_acq_rel) + 1;
+  // Concurrent bids can get here out of order; the newest version wins.
+  std::uint64_t stamped = product.version.load(std::memory_order_relaxed);
+  while (stamped < version &&
+         !product.version.compare_exchange_weak(stamped, version, std::memory_order_relaxed)) {
+  }
+  product_changes_.EndChange(product.index, version);
+  product.stamping.fetch_sub(1, std::memory_order_release);
+}
+
+void AuctionService::TakeChangedProducts(std::vector<std::uint32_t>* indexes) {
+  indexes->clear();
+  {
+    std::lock_guard<std::mutex> lock(changed_mutex_);
+    indexes->swap(changed_);
+  }
+  // Cleared after taking: a change from here on queues the product again,
+  // and the feed reads the product after this, so it misses no change.
+  for (std::uint32_t index : *indexes) {
+    products_[index].queued.store(false, std::memory_order_seq_cst);
+  }
+}
+
+bool AuctionService::ListProduct(std::uint32_t index, ProductInfo* info) const {
+  const Product* product = listedProduct(index);
+  if (product == nullptr) {
+    return false;
+  }
+  fillProductInfo(*product, info);
+  return true;
+}
+
+// Bids that won concurrent CASes can reach the log in either order. Since a
+// product's accepted bids strictly increase, acceptance order is amount
+// order, so each replayed bid is linked into its chain by amount.
+bool AuctionService::replayBid(ProductId id, std::string_view bidder, Cents amount,
+                               std::uint32_t placed_at) {
+  Product* product = findProduct(id);
+  if (product == nullptr) {
+    return false;
+  }
+  NameHandle bidder_index = names_.Intern(bidder);
+  if (bidder_index == InternTable::kFull) {
+    return false;
+  }
+  BidIndex newer = kNoBid;
+  BidIndex older = product->top_bid.load(std::memory_order_relaxed);
+  while (older != kNoBid && journal_[older].amount > amount) {
+    newer = older;
+    older = journal_[older].previous;
+  }
+  BidIndex bid = journal_.Append(product->index, bidder_index, amount, older, placed_at);
+  if (bid == kNoBid) {
+    return false;
+  }
+  if (newer == kNoBid) {
+    product->top_bid.store(bid, std::memory_order_relaxed);
+  } else {
+    journal_[newer].previous = bid;
+  }
+  bid_counts_[shardIndex(id)].value.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+WriteAheadLog::Lsn AuctionService::logMutation(WalRecordType type, const std::string& payload) {
+  return wal_ != nullptr ? wal_->Append(type, payload) : 0;
+}
+
+WriteAheadLog::Lsn AuctionService::logMutations(WalRecordType type,
+                                                const std::vector<std::string>& payloads) {
+  return wal_ != nullptr ? wal_->Append(type, payloads) : 0;
+}
+
+void AuctionService::encodeBid(ProductId product_id, Cents amount, std::uint32_t placed_at,
+                               BidIndex bid, std::string_view bidder, std::string& payload) {
+  RecordWriter writer(payload);
+  writer.PutU64(product_id);
+  writer.PutI64(amount);
+  writer.PutU32(placed_at);
+  writer.PutU32(bid);
+  writer.PutString(bidder);
+}
+
+Status AuctionService::WaitDurable(WriteAheadLog::Lsn lsn, RpcTimer& timer) {
+  bool ok = true;
+  if (lsn != 0) {
+    TraceSpan span("log_wait");
+    ok = wal_->WaitDurable(lsn);
+    timer.Mark(RpcPhase::kLogWait);
+  }
+  timer.Finish();
+  return ok ? Status::OK : logFailed();
+}
+
+void AuctionService::WhenDurable(WriteAheadLog::Lsn lsn, RpcTimer timer,
+                                 std::function<void(Status)> done) {
+  if (lsn == 0) {
+    timer.Finish();
+    done(Status::OK);
+    return;
+  }
+  // No thread waits, so a traced request's wait is recorded on the thread
+  // that ends it.
+  std::uint64_t traced = Tracer::Current();
+  std::int64_t waited_from = traced != 0 ? Tracer::Now() : 0;
+  wal_->WhenDurable(lsn, [timer, traced, waited_from, done = std::move(done)](bool ok) mutable {
+    timer.Mark(RpcPhase::kLogWait);
+    if (traced != 0) {
+      Tracer::Record({"log_wait", traced, waited_from, Tracer::Now(), nullptr, 0});
+    }
+    timer.Finish();
+    done(ok ? Status::OK : logFailed());
+  });
+}
+
+void AuctionService::WhenDurable(WriteAheadLog::Lsn lsn, std::function<void(Status)> done) {
+  if (lsn == 0) {
+    done(Status::OK);
+    return;
+  }
+  wal_->WhenDurable(lsn, [done = std::move(done)](bool ok) { done(ok ? Status::OK : logFailed()); });
+}
+
+Status AuctionService::logFailed() {
+  Log(LogLevel::kError, "Write-ahead log failed, mutation not durable");
+  return Status(grpc::StatusCode::UNAVAILABLE, "write-ahead log unavailable");
+}
+
+Product* AuctionService::findProduct(ProductId id) {
+  Shard<ProductId, std::uint32_t>& shard = product_index_[shardIndex(id)];
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+  const std::uint32_t* index = shard.map.Find(id);
+  return index != nullptr ? &products_[*index] : nullptr;
+}
+
+const Product* AuctionService::listedProduct(std::uint32_t index) const {
+  for (;;) {
+    const Product* product = products_.Find(index);
+    ProductSlot slot =
+        product != nullptr ? product->slot.load(std::memory_order_acquire) : ProductSlot::kFilling;
+    if (slot != ProductSlot::kFilling) {
+      return slot == ProductSlot::kListed ? product : nullptr;
+    }
+    // Another thread is between reserving the slot and publishing the
+    // product, which takes microseconds. Skipping the slot instead would let
+    // a page token move past a product that no page ever returns.
+    std::this_thread::yield();
+  }
+}
+
+void AuctionService::fillProductInfo(const Product& product, ProductInfo* info) const {
+  info->set_id(product.id);
+  info->set_display_id(FormatProductId(product.id));
+  info->set_name(product.name);
+  Cents current_price = currentPrice(product);
+  info->set_initial_price_cents(product.initial_price);
+  info->set_current_price_cents(current_price);
+  info->set_initial_price(CentsToDollars(product.initial_price));
+  info->set_current_price(CentsToDollars(current_price));
+  info->set_seller(names_.Name(product.seller));
+}
+
+Cents AuctionService::currentPrice(const Product& product) const {
+  BidIndex top = product.top_bid.load(std::memory_order_acquire);
+  return top != kNoBid ? journal_[top].amount : product.initial_price;
+}
+
+std::unique_lock<std::mutex> AuctionService::lockBids(Product& product, RpcMethod method) {
+  std::unique_lock<std::mutex> bid_lock(product.bid_mutex, std::try_to_lock);
+  if (!bid_lock.owns_lock()) {
+    RpcTimer waited(method);
+    TraceSpan span("lock_wait");
+    bid_lock.lock();
+    waited.Mark(RpcPhase::kLockWait);
+  }
+  return bid_lock;
+}
+
+BidIndex AuctionService::placeBidLocked(Product& product, std::string_view bidder,
+                                        Cents amount) {
+  std::unique_lock<std::mutex> bid_lock = lockBids(product, RpcMethod::kPlaceBid);
+  return acceptBidLocked(product, bidder, amount);
+}
+
+BidIndex AuctionService::acceptBidLocked(Product& product, std::string_view bidder,
+                                         Cents amount) {
+  BidIndex top = product.top_bid.load(std::memory_order_relaxed);
+  Cents price = top != kNoBid ? journal_[top].amount : product.initial_price;
+  if (amount <= price) {
+    return kNoBid;
+  }
+  NameHandle bidder_index = names_.Intern(bidder);
+  if (bidder_index == InternTable::kFull) {
+    return kNoBid;
+  }
+  BidIndex bid = journal_.Append(product.index, bidder_index, amount, top);
+  if (bid != kNoBid) {
+    product.top_bid.store(bid, std::memory_order_release);
+  }
+  return bid;
+}
+
+// A bid is accepted only by the CAS that links its record on top of the bid
+// it beat, so each product's chain order is exactly the acceptance order.
+// Most losing bids are rejected before touching the journal; one that is
+// outbid after appending is marked void instead.
+BidIndex AuctionService::placeBidCompareAndSwap(Product& product, std::string_view bidder,
+                                                Cents amount) {
+  BidIndex top = product.top_bid.load(std::memory_order_acquire);
+  if (amount <= (top != kNoBid ? journal_[top].amount : product.initial_price)) {
+    return kNoBid;
+  }
+
+  NameHandle bidder_index = names_.Intern(bidder);
+  if (bidder_index == InternTable::kFull) {
+    return kNoBid;
+  }
+  BidIndex bid = journal_.Append(product.index, bidder_index, amount, top);
+  if (bid == kNoBid) {
+    return kNoBid;
+  }
+  BidRecord& record = journal_[bid];
+  while (!product.top_bid.compare_exchange_weak(top, bid, std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
+    if (amount <= (top != kNoBid ? journal_[top].amount : product.initial_price)) {
+      record.previous = kVoidBid;
+      return kNoBid;
+    }
+    record.previous = top;
+    RpcStats::Count(RpcCounter::kBidRetries);
+  }
+  return bid;
+}
+
+std::size_t AuctionService::ProductCount() const {
+  std::size_t total = 0;
+  for (const Shard<ProductId, std::uint32_t>& shard : product_index_) {
+    total += shard.size.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+std::size_t AuctionService::BidCount() const {
+  std::size_t total = 0;
+  for (const PaddedCounter& count : bid_counts_) {
+    total += count.value.load(std::memory_order_relaxed);
+  }
+  return total;
+}
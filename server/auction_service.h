@@ -0,0 +1,379 @@
+#ifndef AUCTION_SERVICE_H
+#define AUCTION_SERVICE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+#include "e-space.grpc.pb.h"
+#include "bid_journal.h"
+#include "change_index.h"
+#include "flat_hash_map.h"
+#include "money.h"
+#include "product_id.h"
+#include "rpc_stats.h"
+#include "segmented_array.h"
+#include "snapshot.h"
+#include "wal.h"
+
+using grpc::ServerContext;
+using grpc::Status;
+
+// Shards are padded to this size so two locks never share a cache line.
+constexpr std::size_t kCacheLineSize = 64;
+constexpr std::size_t kShardCount = 16;
+
+// Largest GetProducts page; larger page_size requests are clamped to it.
+constexpr std::uint32_t kMaxPageSize = 1000;
+// Most items in one AddProducts or PlaceBids call.
+constexpr int kMaxBatchSize = 10000;
+
+// Dense handle for an interned nickname; see InternTable.
+using NameHandle = std::uint32_t;
+
+// Where a products_ slot is in being filled in. A slot reserved for a
+// product that is never added, such as a snapshot placeholder, is kEmpty.
+enum class ProductSlot : std::uint8_t { kFilling, kListed, kEmpty };
+
+struct Product {
+  ProductId id;
+  std::uint32_t index;  // dense index used by bid records
+  std::string name;
+  Cents initial_price;
+  NameHandle seller;
+  // Journal index of the newest accepted bid. The current price is that
+  // record's amount, so raising the price and linking the bid into the
+  // product's chain are the same atomic store.
+  std::atomic<BidIndex> top_bid{kNoBid};
+  std::mutex bid_mutex;  // only used by BidStrategy::kProductLock
+  // Set to kListed, with release, once the fields above are filled in.
+  std::atomic<ProductSlot> slot{ProductSlot::kFilling};
+  // Catalog version of the product's latest change, and how many changes
+  // are between taking a version and storing it here; see touchProduct().
+  std::atomic<std::uint64_t> version{0};
+  std::atomic<std::uint32_t> stamping{0};
+  std::atomic<bool> queued{false};  // waiting in the product feed's change list
+};
+
+// How PlaceBid decides that a bid beats the current price.
+enum class BidStrategy {
+  kProductLock,     // check-then-set under the product's bid_mutex
+  kCompareAndSwap,  // lock-free CAS on Product::top_bid
+};
+
+// One stripe of a keyed table. Readers take the shared lock, inserts take it
+// exclusively; `size` can be read without locking.
+template <typename Key, typename Value>
+struct alignas(kCacheLineSize) Shard {
+  std::shared_mutex mutex;
+  FlatHashMap<Key, Value> map;
+  std::atomic<std::size_t> size{0};
+};
+
+struct alignas(kCacheLineSize) PaddedCounter {
+  std::atomic<std::size_t> value{0};
+};
+
+template <typename Key, typename Value>
+using ShardedMap = std::array<Shard<Key, Value>, kShardCount>;
+
+// Stores each nickname once, whether it belongs to a user, a seller or a
+// bidder, and hands out a dense NameHandle for it. Server structures hold
+// handles, so they cost four bytes and compare as integers; the string is
+// only looked up when a response is built. Names are never removed, so a
+// handle and its string stay valid for the table's lifetime.
+class InternTable {
+public:
+  static constexpr NameHandle kFull = 0xFFFFFFFFu;
+
+  // Per-name flags.
+  static constexpr std::uint32_t kRegisteredUser = 1;
+
+  // Returns the name's handle, adding it if new, or kFull.
+  NameHandle Intern(std::string_view name);
+  const std::string& Name(NameHandle handle) const { return entries_[handle].name; }
+  std::uint32_t size() const { return entries_.size(); }
+
+  // Sets `flag` on the name; returns false if it was already set.
+  bool SetFlag(NameHandle handle, std::uint32_t flag) {
+    return (entries_[handle].flags.fetch_or(flag, std::memory_order_acq_rel) & flag) == 0;
+  }
+  // Safe for any handle below size(), even one still being added.
+  bool HasFlag(NameHandle handle, std::uint32_t flag) const {
+    const Entry* entry = entries_.Find(handle);
+    return entry != nullptr && (entry->flags.load(std::memory_order_acquire) & flag) != 0;
+  }
+
+  // Appends the next handle while loading a snapshot. An absent name keeps
+  // the slot without making it findable.
+  void Restore(std::string_view name, bool present);
+
+  // Estimated bytes held, including the names themselves.
+  std::size_t MemoryBytes();
+
+private:
+  struct Entry {
+    std::string name;
+    std::atomic<std::uint32_t> flags{0};
+  };
+
+  static std::size_t shardIndex(std::string_view name) {
+    return (FlatHash<std::string_view>()(name) >> 32) % kShardCount;
+  }
+
+  // Keys view the strings in entries_, which never move.
+  ShardedMap<std::string_view, NameHandle> handles_;
+  SegmentedArray<Entry, 12> entries_;
+  std::atomic<std::size_t> string_bytes_{0};  // held by names too long for SSO
+};
+
+class ProductFeed;
+
+// The streaming methods are served through the callback API even by the
+// sync server, so that open streams hold no thread. WatchProducts is raw,
+// so that every watcher can be sent the same serialized bytes.
+class AuctionService final
+    : public server::Auction::WithRawCallbackMethod_WatchProducts<
+          server::Auction::WithCallbackMethod_BidStream<
+              server::Auction::WithCallbackMethod_ImportProducts<server::Auction::Service>>> {
+public:
+  explicit AuctionService(BidStrategy strategy = BidStrategy::kCompareAndSwap);
+
+  // Maps a snapshot written by WriteSnapshot() and serves from it; bids are
+  // read from the mapping in place. Sets `wal_start` to where log replay
+  // should resume, the start of the log if there is no snapshot. Call first,
+  // on a new service.
+  bool LoadSnapshot(const std::string& path, WriteAheadLog::Position* wal_start,
+                    std::string* error);
+
+  // Rebuilds state from the write-ahead log in `wal_dir`, starting at
+  // `start`. Mutations already in a loaded snapshot are skipped. Call before
+  // serving.
+  bool Recover(const std::string& wal_dir, const WriteAheadLog::Position& start,
+               std::string* error);
+
+  // Writes a snapshot of the current state to `path` while RPCs keep running,
+  // pacing its writes through `limiter` if given. `covered` receives the log
+  // position the snapshot includes everything before. Safe to call from a
+  // background thread; concurrent calls are serialized.
+  bool WriteSnapshot(const std::string& path, RateLimiter* limiter,
+                     WriteAheadLog::Position* covered, std::string* error);
+
+  // Once set, every mutation is logged and acknowledged only after its
+  // record is durable. Call before serving.
+  void SetWriteAheadLog(WriteAheadLog* wal) { wal_ = wal; }
+  // Serves WatchProducts from `feed` and starts queueing changed products
+  // for it. Call before serving.
+  void SetProductFeed(ProductFeed* feed);
+
+  Status RegisterUser(ServerContext* context,
+                      const server::RegisterUserRequest* request,
+                      server::RegisterUserResponse* response) override;
+
+  Status AddProduct(ServerContext* context,
+                    const server::AddProductRequest* request,
+                    server::AddProductResponse* response) override;
+
+  // Lists products in creation order. With page_size 0 the whole catalog
+  // is returned in one response; otherwise at most kMaxPageSize per page.
+  // With since_version, only products changed after that catalog version
+  // are listed, and nothing at all if the catalog has not changed; slots
+  // with no such change are skipped a block at a time, see ChangeIndex.
+  Status GetProducts(ServerContext* context,
+                     const server::GetProductsRequest* request,
+                     server::GetProductsResponse* response) override;
+
+  Status PlaceBid(ServerContext* context,
+                  const server::PlaceBidRequest* request,
+                  server::PlaceBidResponse* response) override;
+
+  // Batches of AddProduct and PlaceBid, applied in one pass: each index
+  // shard, product and bid lock is taken once per batch rather than once
+  // per item, and all of the log records are queued together.
+  Status AddProducts(ServerContext* context,
+                     const server::AddProductsRequest* request,
+                     server::AddProductsResponse* response) override;
+
+  Status PlaceBids(ServerContext* context,
+                   const server::PlaceBidsRequest* request,
+                   server::PlaceBidsResponse* response) override;
+
+  grpc::ServerWriteReactor<grpc::ByteBuffer>* WatchProducts(
+      grpc::CallbackServerContext* context, const grpc::ByteBuffer* request) override;
+
+  grpc::ServerBidiReactor<server::BidStreamRequest, server::BidStreamResponse>* BidStream(
+      grpc::CallbackServerContext* context) override;
+
+  grpc::ServerReadReactor<server::ImportProductsRequest>* ImportProducts(
+      grpc::CallbackServerContext* context, server::ImportProductsResponse* response) override;
+
+  Status GetServerStats(ServerContext* context,
+                        const server::GetServerStatsRequest* request,
+                        server::GetServerStatsResponse* response) override;
+
+  Status DumpTrace(ServerContext* context, const server::DumpTraceRequest* request,
+                   server::DumpTraceResponse* response) override;
+
+  // The mutating handlers in two steps, for servers that should not hold a
+  // thread while the log syncs. Apply*() makes the change, fills in
+  // `response` and sets `durable_at` to the log record that must be durable
+  // before the response is sent, or 0 if there is none. The handlers above
+  // are Apply*() followed by WaitDurable().
+  void ApplyRegisterUser(const server::RegisterUserRequest* request,
+                         server::RegisterUserResponse* response,
+                         WriteAheadLog::Lsn* durable_at);
+  void ApplyAddProduct(const server::AddProductRequest* request,
+                       server::AddProductResponse* response, WriteAheadLog::Lsn* durable_at);
+  void ApplyPlaceBid(const server::PlaceBidRequest* request, server::PlaceBidResponse* response,
+                     WriteAheadLog::Lsn* durable_at);
+  // The batch forms fail with INVALID_ARGUMENT, changing nothing, when
+  // given more than kMaxBatchSize items.
+  Status ApplyAddProducts(const server::AddProductsRequest* request,
+                          server::AddProductsResponse* response, WriteAheadLog::Lsn* durable_at);
+  Status ApplyPlaceBids(const server::PlaceBidsRequest* request,
+                        server::PlaceBidsResponse* response, WriteAheadLog::Lsn* durable_at);
+  // One ImportProducts chunk, as AddProducts without per-item responses:
+  // sets ids[i] to the i-th product's ID, or 0 if it was rejected. `ids`
+  // has room for every product in the chunk.
+  Status ApplyImportChunk(const server::ImportProductsRequest* request, ProductId* ids,
+                          WriteAheadLog::Lsn* durable_at);
+
+  // The status to answer with once `durable_at` is durable: OK, or
+  // UNAVAILABLE if the log failed. Records the call's log wait and total in
+  // `timer`.
+  Status WaitDurable(WriteAheadLog::Lsn durable_at, RpcTimer& timer);
+  // Like WaitDurable(), but calls done(status) instead of blocking: at once
+  // if there is nothing to wait for, otherwise from the log's writer thread.
+  void WhenDurable(WriteAheadLog::Lsn durable_at, RpcTimer timer,
+                   std::function<void(Status)> done);
+  // The same for callers that record their own timings.
+  void WhenDurable(WriteAheadLog::Lsn durable_at, std::function<void(Status)> done);
+
+  // Allocates journal space for `count` bids in total up front, so bids up
+  // to there never allocate on the PlaceBid path.
+  void ReserveBids(std::uint32_t count) { journal_.Reserve(count); }
+
+  // GetProducts without recording the call in RpcStats or tracing it.
+  Status ListProducts(const server::GetProductsRequest* request,
+                      server::GetProductsResponse* response);
+  // Fills in the product in slot `index`; false if there is none.
+  bool ListProduct(std::uint32_t index, server::ProductInfo* info) const;
+  // Moves the slots of products changed since the last call into `indexes`.
+  void TakeChangedProducts(std::vector<std::uint32_t>* indexes);
+
+  std::size_t ProductCount() const;
+  std::uint64_t CatalogVersion() const {
+    return catalog_version_.load(std::memory_order_acquire);
+  }
+  std::size_t BidCount() const;
+  std::size_t UserCount() const { return user_count_.load(std::memory_order_relaxed); }
+
+  // Calls fn(record) for each accepted bid on the product, newest first.
+  // Returns false if the product does not exist.
+  template <typename Fn>
+  bool ForEachBid(ProductId id, Fn&& fn);
+  // The nickname behind a handle, e.g. BidRecord::bidder.
+  const std::string& Nickname(NameHandle handle) const { return names_.Name(handle); }
+  BidStrategy strategy() const { return strategy_; }
+
+private:
+  const BidStrategy strategy_;
+  WriteAheadLog* wal_ = nullptr;
+  // Products by Product::index. Never erased or moved, so a Product& stays
+  // valid after the index lookup's shard lock is released.
+  SegmentedArray<Product, 12> products_;
+  // Where in products_ a since_version listing has to look.
+  ChangeIndex product_changes_{SegmentedArray<Product, 12>::kCapacity};
+  std::atomic<std::size_t> product_name_bytes_{0};  // held by names too long for SSO
+  // ProductId -> Product::index.
+  ShardedMap<ProductId, std::uint32_t> product_index_;
+  BidJournal journal_;
+  // Every nickname; users are the names flagged kRegisteredUser.
+  InternTable names_;
+  std::atomic<std::size_t> user_count_{0};
+  // Bumped by every product added and bid accepted. Starts at the time the
+  // server started, in microseconds, so versions handed out by an earlier
+  // run of the server are older than anything this one lists.
+  std::atomic<std::uint64_t> catalog_version_;
+  ProductFeed* feed_ = nullptr;
+  std::atomic<bool> track_changes_{false};
+  std::mutex changed_mutex_;
+  std::vector<std::uint32_t> changed_;  // guarded by changed_mutex_
+  // Accepted bids, striped like products_ so bids on different products do
+  // not share a line. The journal size also counts void records.
+  std::array<PaddedCounter, kShardCount> bid_counts_;
+  ProductIdGenerator product_ids_;
+  // The mapped snapshot the journal's first snapshot_bids_ records live in.
+  std::unique_ptr<SnapshotFile> snapshot_;
+  BidIndex snapshot_bids_ = 0;
+  std::mutex snapshot_mutex_;  // one WriteSnapshot() at a time
+  // Held shared from logging a new product to listing it, and exclusively
+  // by WriteSnapshot() to read the log's tail, so that every product logged
+  // before the tail is listed by the time the snapshot is taken.
+  std::shared_mutex publish_mutex_;
+
+  static std::size_t shardIndex(ProductId id) {
+    return HashProductId(id) % kShardCount;
+  }
+
+  bool insertUser(std::string_view nickname);
+  Product* insertProduct(ProductId id, const std::string& name, Cents initial_price,
+                         NameHandle seller);
+  // insertProduct() in two steps: fillProduct() reserves and fills in a
+  // slot, and listProducts() makes products findable and listed, locking
+  // each index shard once for all of them. Readers of the catalog wait on
+  // a slot in between, so list soon after filling. A new product is logged
+  // in between, under publish_mutex_.
+  Product* fillProduct(ProductId id, const std::string& name, Cents initial_price,
+                       NameHandle seller);
+  void listProducts(Product** products, std::size_t count);
+  // Adds `items` a chunk at a time, each chunk filled in, logged and then
+  // listed, setting ids[i] as ApplyImportChunk() does; returns the LSN of
+  // the last record, or 0.
+  WriteAheadLog::Lsn addProducts(
+      const google::protobuf::RepeatedPtrField<server::AddProductRequest>& items, ProductId* ids);
+  // Takes the next catalog version for a change just made to `product`.
+  void touchProduct(Product& product);
+  bool replayBid(ProductId id, std::string_view bidder, Cents amount,
+                 std::uint32_t placed_at);
+  // Queues the record and returns its LSN, or 0 without a log.
+  WriteAheadLog::Lsn logMutation(WalRecordType type, const std::string& payload);
+  // The same for a batch: one record per payload, the last one's LSN.
+  WriteAheadLog::Lsn logMutations(WalRecordType type, const std::vector<std::string>& payloads);
+  static void encodeBid(ProductId product_id, Cents amount, std::uint32_t placed_at, BidIndex bid,
+                        std::string_view bidder, std::string& payload);
+  static Status logFailed();
+
+  Product* findProduct(ProductId id);
+  // The product in slot `index`, waiting out a concurrent insert still
+  // filling it in; nullptr if the slot is empty.
+  const Product* listedProduct(std::uint32_t index) const;
+  void fillProductInfo(const Product& product, server::ProductInfo* info) const;
+  Cents currentPrice(const Product& product) const;
+  // Locks the product's bid_mutex, recording any wait under `method`.
+  std::unique_lock<std::mutex> lockBids(Product& product, RpcMethod method);
+  BidIndex placeBidLocked(Product& product, std::string_view bidder, Cents amount);
+  // placeBidLocked() for a caller already holding the product's bid_mutex.
+  BidIndex acceptBidLocked(Product& product, std::string_view bidder, Cents amount);
+  BidIndex placeBidCompareAndSwap(Product& product, std::string_view bidder, Cents amount);
+};
+
+template <typename Fn>
+bool AuctionService::ForEachBid(ProductId id, Fn&& fn) {
+  Product* product = findProduct(id);
+  if (product == nullptr) {
+    return false;
+  }
+  journal_.ForEachInChain(product->top_bid.load(std::memory_order_acquire),
+                          [&](BidIndex, const BidRecord& record) { fn(record); });
+  return true;
+}
+
+#endif // AUCTION_SERVICE_H
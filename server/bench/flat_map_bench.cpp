@@ -0,0 +1,154 @@
+// FlatHashMap against the std::unordered_map it replaced, for the two key
+// shapes the server uses: 64-bit product IDs and short nicknames.
+//
+// Insert builds a table of N entries from empty. Lookup finds every key of a
+// prebuilt table in a shuffled order. For string keys the std::unordered_map
+// lookup goes through a std::string temporary, as it did for string_view
+// input before; FlatHashMap looks the string_view up directly. The 10M cases
+// need about 2 GB of memory; --benchmark_filter=/10000$ runs the quick ones.
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "flat_hash_map.h"
+#include "product_id.h"
+
+namespace {
+
+// Snowflake-shaped IDs, as ProductIdGenerator hands out.
+const std::vector<std::uint64_t>& IdKeys(std::size_t count) {
+  static std::vector<std::uint64_t> keys;
+  if (keys.size() != count) {
+    ProductIdGenerator generator;
+    keys.resize(count);
+    for (std::uint64_t& key : keys) {
+      key = generator.Next();
+    }
+  }
+  return keys;
+}
+
+const std::vector<std::string>& NameKeys(std::size_t count) {
+  static std::vector<std::string> keys;
+  if (keys.size() != count) {
+    keys.resize(count);
+    char name[32];
+    for (std::size_t i = 0; i < count; ++i) {
+      std::snprintf(name, sizeof(name), "bidder%zu", i);
+      keys[i] = name;
+    }
+  }
+  return keys;
+}
+
+std::vector<std::size_t> ShuffledOrder(std::size_t count) {
+  std::vector<std::size_t> order(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+  return order;
+}
+
+struct StdIdMap {
+  static constexpr auto Keys = IdKeys;
+  std::unordered_map<std::uint64_t, std::uint32_t> map;
+  void Insert(std::uint64_t key, std::uint32_t value) { map.try_emplace(key, value); }
+  const std::uint32_t* Find(std::uint64_t key) const {
+    auto it = map.find(key);
+    return it != map.end() ? &it->second : nullptr;
+  }
+};
+
+struct FlatIdMap {
+  static constexpr auto Keys = IdKeys;
+  FlatHashMap<std::uint64_t, std::uint32_t> map;
+  void Insert(std::uint64_t key, std::uint32_t value) { map.TryEmplace(key, value); }
+  const std::uint32_t* Find(std::uint64_t key) const { return map.Find(key); }
+};
+
+struct StdNameMap {
+  static constexpr auto Keys = NameKeys;
+  std::unordered_map<std::string, std::uint32_t> map;
+  void Insert(std::string_view key, std::uint32_t value) {
+    map.try_emplace(std::string(key), value);
+  }
+  const std::uint32_t* Find(std::string_view key) const {
+    auto it = map.find(std::string(key));
+    return it != map.end() ? &it->second : nullptr;
+  }
+};
+
+struct FlatNameMap {
+  static constexpr auto Keys = NameKeys;
+  FlatHashMap<std::string, std::uint32_t> map;
+  void Insert(std::string_view key, std::uint32_t value) { map.TryEmplace(key, value); }
+  const std::uint32_t* Find(std::string_view key) const { return map.Find(key); }
+};
+
+template <typename Map>
+void FillMap(Map& map, const std::vector<std::uint64_t>& keys) {
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    map.Insert(keys[i], static_cast<std::uint32_t>(i));
+  }
+}
+
+template <typename Map>
+void FillMap(Map& map, const std::vector<std::string>& keys) {
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    map.Insert(keys[i], static_cast<std::uint32_t>(i));
+  }
+}
+
+template <typename Map>
+void BM_Insert(benchmark::State& state) {
+  const auto& keys = Map::Keys(static_cast<std::size_t>(state.range(0)));
+  for (auto _ : state) {
+    auto map = std::make_unique<Map>();
+    FillMap(*map, keys);
+    benchmark::DoNotOptimize(map->Find(keys.front()));
+    state.PauseTiming();  // freeing the table is not part of inserting
+    map.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <typename Map>
+void BM_Lookup(benchmark::State& state) {
+  std::size_t count = static_cast<std::size_t>(state.range(0));
+  const auto& keys = Map::Keys(count);
+  Map map;
+  FillMap(map, keys);
+  std::vector<std::size_t> order = ShuffledOrder(count);
+  for (auto _ : state) {
+    for (std::size_t i : order) {
+      benchmark::DoNotOptimize(map.Find(keys[i]));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void Sizes(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgName("entries")->Arg(10000)->Arg(1000000)->Arg(10000000);
+  benchmark->Unit(benchmark::kMillisecond);
+}
+
+BENCHMARK_TEMPLATE(BM_Insert, StdIdMap)->Apply(Sizes);
+BENCHMARK_TEMPLATE(BM_Insert, FlatIdMap)->Apply(Sizes);
+BENCHMARK_TEMPLATE(BM_Lookup, StdIdMap)->Apply(Sizes);
+BENCHMARK_TEMPLATE(BM_Lookup, FlatIdMap)->Apply(Sizes);
+BENCHMARK_TEMPLATE(BM_Insert, StdNameMap)->Apply(Sizes);
+BENCHMARK_TEMPLATE(BM_Insert, FlatNameMap)->Apply(Sizes);
+BENCHMARK_TEMPLATE(BM_Lookup, StdNameMap)->Apply(Sizes);
+BENCHMARK_TEMPLATE(BM_Lookup, FlatNameMap)->Apply(Sizes);
+
+}  // namespace
+
+BENCHMARK_MAIN();
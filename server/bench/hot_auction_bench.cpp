@@ -0,0 +1,130 @@
+// PlaceBid under contention, for each BidStrategy: 1 to 32 threads bid on
+// one product (a hot auction in its last minute), on 8 products, or on 4096
+// products picked uniformly at random.
+//
+// A bid's amount is the time it was made, as if every bidder topped the
+// price they last saw, so a bid is accepted only if no later one got in
+// first. Counters:
+//   accepted   accepted bids per second, over all threads
+//   fairness   Jain's index of accepted bids per thread: 1 when every thread
+//              won equally often, 1/threads when one thread won them all
+//   min_share  the least successful thread's accepted bids over the mean
+//   p50/p99/p999_ns  latency of one PlaceBid call, accepted or not
+// The handlers run without a write-ahead log and with logging off, so the
+// bid-acceptance path is all that is measured.
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "auction_service.h"
+#include "rpc_stats.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// One thread's results, written only by that thread during the run.
+struct alignas(kCacheLineSize) ThreadResult {
+  LatencyHistogram latency;
+  std::int64_t accepted = 0;
+};
+
+std::unique_ptr<AuctionService> g_service;
+std::vector<ProductId> g_product_ids;
+std::vector<std::unique_ptr<ThreadResult>> g_results;
+Clock::time_point g_start;
+
+std::int64_t Nanos(Clock::duration elapsed) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+void SetUp(BidStrategy strategy, int products, int threads) {
+  g_service = std::make_unique<AuctionService>(strategy);
+  g_product_ids.clear();
+  for (int i = 0; i < products; ++i) {
+    server::AddProductRequest request;
+    request.set_name("hot item " + std::to_string(i));
+    request.set_initial_price_cents(100);
+    request.set_seller("seller");
+    server::AddProductResponse response;
+    g_service->AddProduct(nullptr, &request, &response);
+    g_product_ids.push_back(response.product_id());
+  }
+  g_results.clear();
+  for (int i = 0; i < threads; ++i) {
+    g_results.push_back(std::make_unique<ThreadResult>());
+  }
+  g_start = Clock::now();
+}
+
+// Run by thread 0 once every thread has left the timed loop.
+void Report(benchmark::State& state) {
+  LatencyCounts latency;
+  double sum = 0;
+  double sum_of_squares = 0;
+  std::int64_t least = g_results[0]->accepted;
+  for (const std::unique_ptr<ThreadResult>& result : g_results) {
+    latency.Add(result->latency);
+    double accepted = static_cast<double>(result->accepted);
+    sum += accepted;
+    sum_of_squares += accepted * accepted;
+    least = std::min(least, result->accepted);
+  }
+  double threads = static_cast<double>(g_results.size());
+  state.counters["fairness"] = sum_of_squares > 0 ? sum * sum / (threads * sum_of_squares) : 0;
+  state.counters["min_share"] = sum > 0 ? static_cast<double>(least) / (sum / threads) : 0;
+  state.counters["p50_ns"] = static_cast<double>(latency.Percentile(0.5));
+  state.counters["p99_ns"] = static_cast<double>(latency.Percentile(0.99));
+  state.counters["p999_ns"] = static_cast<double>(latency.Percentile(0.999));
+}
+
+void BM_HotAuction(benchmark::State& state) {
+  int products = static_cast<int>(state.range(1));
+  if (state.thread_index() == 0) {
+    SetUp(static_cast<BidStrategy>(state.range(0)), products, state.threads());
+  }
+
+  server::PlaceBidRequest request;
+  request.set_bidder("bidder " + std::to_string(state.thread_index()));
+  server::PlaceBidResponse response;
+  std::minstd_rand rng(static_cast<unsigned>(state.thread_index()) + 1);
+  std::uniform_int_distribution<int> pick(0, products - 1);
+  ThreadResult* result = nullptr;
+
+  for (auto _ : state) {
+    if (result == nullptr) {
+      result = g_results[static_cast<std::size_t>(state.thread_index())].get();
+    }
+    request.set_product_id(g_product_ids[static_cast<std::size_t>(pick(rng))]);
+    Clock::time_point started = Clock::now();
+    request.set_amount_cents(100 + Nanos(started - g_start));
+    g_service->PlaceBid(nullptr, &request, &response);
+    result->latency.Record(static_cast<std::uint64_t>(Nanos(Clock::now() - started)));
+    result->accepted += response.success();
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  if (result != nullptr) {
+    state.counters["accepted"] = benchmark::Counter(static_cast<double>(result->accepted),
+                                                    benchmark::Counter::kIsRate);
+  }
+  if (state.thread_index() == 0) {
+    Report(state);
+    g_service.reset();
+  }
+}
+
+BENCHMARK(BM_HotAuction)
+    ->ArgNames({"strategy", "products"})
+    ->ArgsProduct({{static_cast<int>(BidStrategy::kProductLock),
+                    static_cast<int>(BidStrategy::kCompareAndSwap)},
+                   {1, 8, 4096}})
+    ->ThreadRange(1, 32)
+    ->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
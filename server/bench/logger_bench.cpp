@@ -0,0 +1,81 @@
+// Cost to the calling thread of one PlaceBid-style log line, as threads are
+// added.
+//
+// FlushedLine is how the handlers used to log: format the line on the
+// calling thread and flush it with a write() each time, through a stream
+// every thread shares. LogLine is Log(): copy the fields into the thread's
+// ring and return. Both write to /dev/null. Times are the calling thread's
+// CPU time, system calls included.
+//
+// A tight loop fills a ring far faster than the formatter drains it, so
+// LogLine logs a fixed number of lines that fit in the ring; otherwise it
+// would time the drop path. `dropped` should stay 0.
+#include <benchmark/benchmark.h>
+#include <cinttypes>
+#include <cstdio>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include "logger.h"
+
+namespace {
+
+constexpr ProductId kProductId = 123456789012345ull;
+constexpr std::size_t kRingRecords = 1 << 14;
+
+void BM_FlushedLine(benchmark::State& state) {
+  static std::FILE* out = nullptr;
+  if (state.thread_index() == 0) {
+    out = std::fopen("/dev/null", "w");
+  }
+  Cents amount = 100;
+  for (auto _ : state) {
+    ++amount;
+    std::fprintf(out, "[LOG] Bid placed successfully for product PROD_%" PRIu64
+                      " new price: %s\n",
+                 kProductId, FormatCents(amount).c_str());
+    std::fflush(out);
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    std::fclose(out);
+  }
+}
+
+void BM_LogLine(benchmark::State& state) {
+  // Lets the formatter empty the ring after the previous run.
+  std::this_thread::sleep_for(4 * LoggerOptions().poll_interval);
+  std::uint64_t dropped_before = Logger::Dropped();
+  Cents amount = 100;
+  for (auto _ : state) {
+    ++amount;
+    Log(LogLevel::kInfo, "Bid placed successfully for product {} new price: {}",
+        ProductIdText{kProductId}, CentsText{amount});
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    state.counters["dropped"] = static_cast<double>(Logger::Dropped() - dropped_before);
+  }
+}
+
+BENCHMARK(BM_FlushedLine)->ThreadRange(1, 16);
+BENCHMARK(BM_LogLine)->ThreadRange(1, 16)->Iterations(kRingRecords)->Repetitions(10)
+    ->ReportAggregatesOnly();
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  LoggerOptions log_options;
+  log_options.fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+  log_options.ring_records = kRingRecords;
+  Logger::Start(log_options);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  Logger::Stop();
+  ::close(log_options.fd);
+  return 0;
+}
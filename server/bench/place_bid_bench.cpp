@@ -0,0 +1,205 @@
+// PlaceBid throughput as threads are added, for each BidStrategy.
+//
+// DisjointProducts gives every thread its own product, so the handlers should
+// not contend and items/s should grow with the thread count. SingleProduct is
+// the flash-sale case: every thread bids on one product.
+//
+// PlaceBidAllocations counts heap allocations made while bids are accepted,
+// with and without the write-ahead log; any allocation fails the run with a
+// non-zero exit status.
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "auction_service.h"
+#include "logger.h"
+
+namespace {
+
+std::atomic<std::uint64_t> g_allocations{0};
+// Set by PlaceBidAllocations so that an allocating PlaceBid fails the run.
+bool g_allocation_check_failed = false;
+
+}  // namespace
+
+// The replacements are kept out of line. Otherwise GCC sees malloc() and
+// free() through the inlined bodies and reports -Wmismatched-new-delete.
+[[gnu::noinline]] void* operator new(std::size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size != 0 ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+namespace {
+
+std::unique_ptr<AuctionService> g_service;
+std::vector<ProductId> g_product_ids;
+
+void SetUpProducts(BidStrategy strategy, int count) {
+  g_service = std::make_unique<AuctionService>(strategy);
+  g_product_ids.clear();
+  for (int i = 0; i < count; ++i) {
+    server::AddProductRequest request;
+    request.set_name("bench item " + std::to_string(i));
+    request.set_initial_price_cents(100);
+    request.set_seller("bench");
+    server::AddProductResponse response;
+    g_service->AddProduct(nullptr, &request, &response);
+    g_product_ids.push_back(response.product_id());
+  }
+}
+
+void RunBids(benchmark::State& state, int product_count) {
+  if (state.thread_index() == 0) {
+    SetUpProducts(static_cast<BidStrategy>(state.range(0)), product_count);
+  }
+
+  server::PlaceBidRequest request;
+  request.set_bidder("bidder" + std::to_string(state.thread_index()));
+  server::PlaceBidResponse response;
+  // Distinct, rising amounts per thread; on a shared product a thread that
+  // falls behind gets outbid, as in a real auction.
+  Cents amount = 100 + state.thread_index();
+  std::int64_t accepted = 0;
+  bool set_up = false;
+
+  for (auto _ : state) {
+    if (!set_up) {
+      request.set_product_id(g_product_ids[state.thread_index() % product_count]);
+      set_up = true;
+    }
+    amount += state.threads();
+    request.set_amount_cents(amount);
+    g_service->PlaceBid(nullptr, &request, &response);
+    accepted += response.success();
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["accepted"] = benchmark::Counter(static_cast<double>(accepted),
+                                                  benchmark::Counter::kIsRate);
+}
+
+void BM_PlaceBidDisjointProducts(benchmark::State& state) {
+  RunBids(state, state.threads());
+}
+
+void BM_PlaceBidSingleProduct(benchmark::State& state) {
+  RunBids(state, 1);
+}
+
+constexpr int kAllocationBids = 100000;
+
+// Accepted bids on one product from one bidder, after a warm-up bid has
+// interned the bidder, created the thread's record buffer and log ring and,
+// with the log on, sized its queues.
+void BM_PlaceBidAllocations(benchmark::State& state) {
+  SetUpProducts(BidStrategy::kCompareAndSwap, 1);
+  g_service->ReserveBids(kAllocationBids + 1);
+
+  std::unique_ptr<WriteAheadLog> wal;
+  char dir[] = "/tmp/place_bid_bench.XXXXXX";
+  bool logged = state.range(0) != 0;
+  if (logged) {
+    if (::mkdtemp(dir) == nullptr) {
+      state.SkipWithError("mkdtemp failed");
+      return;
+    }
+    WalOptions options;
+    options.dir = dir;
+    options.sync_policy = SyncPolicy::kNone;
+    wal = std::make_unique<WriteAheadLog>(options);
+    std::string error;
+    if (!wal->Open(&error)) {
+      state.SkipWithError(error.c_str());
+      return;
+    }
+    g_service->SetWriteAheadLog(wal.get());
+  }
+
+  server::PlaceBidRequest request;
+  request.set_product_id(g_product_ids[0]);
+  request.set_bidder("a bidder with a name too long for SSO");
+  server::PlaceBidResponse response;
+  Cents amount = 100;
+  request.set_amount_cents(++amount);
+  g_service->PlaceBid(nullptr, &request, &response);
+
+  std::uint64_t allocations = 0;
+  std::int64_t accepted = 0;
+  for (auto _ : state) {
+    std::uint64_t before = g_allocations.load(std::memory_order_relaxed);
+    request.set_amount_cents(++amount);
+    g_service->PlaceBid(nullptr, &request, &response);
+    allocations += g_allocations.load(std::memory_order_relaxed) - before;
+    accepted += response.success();
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["allocs/bid"] =
+      static_cast<double>(allocations) / static_cast<double>(std::max<std::int64_t>(accepted, 1));
+  if (accepted != state.iterations()) {
+    g_allocation_check_failed = true;
+    state.SkipWithError("bids were rejected");
+  } else if (allocations != 0) {
+    g_allocation_check_failed = true;
+    state.SkipWithError("PlaceBid allocated");
+  }
+
+  g_service.reset();
+  if (logged) {
+    wal->Close();
+    for (std::uint64_t segment : WriteAheadLog::ListSegments(dir)) {
+      std::remove(WriteAheadLog::SegmentPath(dir, segment).c_str());
+    }
+    ::rmdir(dir);
+  }
+}
+
+void StrategyArgs(benchmark::internal::Benchmark* bench) {
+  bench->ArgName("strategy")
+      ->Arg(static_cast<int>(BidStrategy::kProductLock))
+      ->Arg(static_cast<int>(BidStrategy::kCompareAndSwap))
+      ->ThreadRange(1, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+      ->UseRealTime();
+}
+
+BENCHMARK(BM_PlaceBidDisjointProducts)->Apply(StrategyArgs);
+BENCHMARK(BM_PlaceBidSingleProduct)->Apply(StrategyArgs);
+BENCHMARK(BM_PlaceBidAllocations)->ArgName("wal")->Arg(0)->Arg(1)->Iterations(kAllocationBids);
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  // Handlers log as they do in the server, at the default level, so the
+  // cost of logging is measured; the lines themselves go to /dev/null.
+  LoggerOptions log_options;
+  log_options.fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+  Logger::Start(log_options);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  Logger::Stop();
+  ::close(log_options.fd);
+  return g_allocation_check_failed ? 1 : 0;
+}
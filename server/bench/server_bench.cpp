@@ -0,0 +1,471 @@
+// The AuctionService handlers in-process, at 1 to 8 threads. path:0 calls
+// each handler directly, so only the service's own data structures are
+// measured; path:1 makes the same call through a gRPC in-process channel,
+// which adds serialization and gRPC's call machinery but no network. The
+// difference between the two is the RPC layer's cost.
+//
+// RegisterUser and AddProduct insert a new user or product per call.
+// GetProducts lists the whole catalog, at growing catalog sizes; items/s
+// counts products listed. GetProductsPage fetches one page from a random
+// point in a 100k-product catalog, which should cost the same at any point.
+// PlaceBid covers an accepted bid, one below the current price and one on a
+// product that does not exist. BidStream sends accepted bids on one
+// BidStream call per thread, in-process only, with up to `window` bids
+// awaiting their results; compare it with PlaceBid/path:1/outcome:0.
+// AddProducts and PlaceBids send `batch` inserts or accepted bids per call;
+// items/s counts items, so batch:1 against AddProduct and PlaceBid is the
+// batch RPC's overhead, and larger batches its saving. ImportProducts
+// uploads 100k products per iteration on one call, in-process only, in
+// chunks of `chunk`. No write-ahead log; handlers log at the default level,
+// to /dev/null.
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <grpcpp/grpcpp.h>
+#include "auction_service.h"
+#include "logger.h"
+
+namespace {
+
+enum Path { kDirect, kInProcess };
+
+enum BidOutcome { kAccepted, kOutbid, kNoSuchProduct };
+
+constexpr Cents kInitialPrice = 100;
+
+std::unique_ptr<AuctionService> g_service;
+std::unique_ptr<grpc::Server> g_server;
+std::vector<std::unique_ptr<server::Auction::Stub>> g_stubs;  // one per thread
+std::vector<ProductId> g_product_ids;
+// BidStream calls still being drained after the timed loop, which has no
+// barrier at its end, so thread 0 must wait before tearing down.
+std::atomic<int> g_open_streams{0};
+
+// Called by thread 0 before the timed loop; the other threads wait for it
+// at the loop's start.
+void SetUp(benchmark::State& state, Path path) {
+  g_service = std::make_unique<AuctionService>();
+  g_product_ids.clear();
+  if (path == kInProcess) {
+    grpc::ServerBuilder builder;
+    builder.RegisterService(g_service.get());
+    g_server = builder.BuildAndStart();
+    // The largest catalogs exceed the default 4 MB limit on a response.
+    grpc::ChannelArguments args;
+    args.SetMaxReceiveMessageSize(-1);
+    for (int i = 0; i < state.threads(); ++i) {
+      g_stubs.push_back(server::Auction::NewStub(g_server->InProcessChannel(args)));
+    }
+  }
+}
+
+void TearDown() {
+  g_stubs.clear();
+  if (g_server != nullptr) {
+    g_server->Shutdown();
+    g_server.reset();
+  }
+  g_service.reset();
+}
+
+void AddProducts(int count) {
+  for (int i = 0; i < count; ++i) {
+    server::AddProductRequest request;
+    request.set_name("bench item " + std::to_string(i));
+    request.set_initial_price_cents(kInitialPrice);
+    request.set_seller("bench seller");
+    server::AddProductResponse response;
+    g_service->AddProduct(nullptr, &request, &response);
+    g_product_ids.push_back(response.product_id());
+  }
+}
+
+// Calls the handler directly, or through the thread's in-process stub.
+template <typename Request, typename Response>
+bool Invoke(benchmark::State& state,
+            Status (AuctionService::*handler)(ServerContext*, const Request*, Response*),
+            grpc::Status (server::Auction::Stub::*method)(grpc::ClientContext*, const Request&,
+                                                         Response*),
+            const Request& request, Response& response) {
+  response.Clear();
+  if (g_stubs.empty()) {
+    return (g_service.get()->*handler)(nullptr, &request, &response).ok();
+  }
+  grpc::ClientContext context;
+  return (g_stubs[state.thread_index()].get()->*method)(&context, request, &response).ok();
+}
+
+void BM_RegisterUser(benchmark::State& state) {
+  if (state.thread_index() == 0) {
+    SetUp(state, static_cast<Path>(state.range(0)));
+  }
+  server::RegisterUserRequest request;
+  server::RegisterUserResponse response;
+  std::string prefix = "user " + std::to_string(state.thread_index()) + ".";
+  std::int64_t failed = 0;
+  std::int64_t next = 0;
+
+  for (auto _ : state) {
+    request.set_nickname(prefix + std::to_string(next++));
+    failed += !Invoke(state, &AuctionService::RegisterUser, &server::Auction::Stub::RegisterUser,
+                      request, response) ||
+              !response.success();
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  if (failed != 0) {
+    state.SkipWithError("registrations failed");
+  }
+  if (state.thread_index() == 0) {
+    TearDown();
+  }
+}
+
+void BM_AddProduct(benchmark::State& state) {
+  if (state.thread_index() == 0) {
+    SetUp(state, static_cast<Path>(state.range(0)));
+  }
+  server::AddProductRequest request;
+  request.set_name("bench item");
+  request.set_initial_price_cents(kInitialPrice);
+  request.set_seller("seller " + std::to_string(state.thread_index()));
+  server::AddProductResponse response;
+  std::int64_t failed = 0;
+
+  for (auto _ : state) {
+    failed += !Invoke(state, &AuctionService::AddProduct, &server::Auction::Stub::AddProduct,
+                      request, response) ||
+              !response.success();
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  if (failed != 0) {
+    state.SkipWithError("inserts failed");
+  }
+  if (state.thread_index() == 0) {
+    TearDown();
+  }
+}
+
+void BM_GetProducts(benchmark::State& state) {
+  int catalog = static_cast<int>(state.range(1));
+  if (state.thread_index() == 0) {
+    SetUp(state, static_cast<Path>(state.range(0)));
+    AddProducts(catalog);
+  }
+  server::GetProductsRequest request;
+  server::GetProductsResponse response;
+  std::int64_t failed = 0;
+
+  for (auto _ : state) {
+    failed += !Invoke(state, &AuctionService::GetProducts, &server::Auction::Stub::GetProducts,
+                      request, response) ||
+              response.products_size() != catalog;
+  }
+
+  state.SetItemsProcessed(state.iterations() * catalog);
+  if (failed != 0) {
+    state.SkipWithError("listings failed or were incomplete");
+  }
+  if (state.thread_index() == 0) {
+    TearDown();
+  }
+}
+
+void BM_GetProductsPage(benchmark::State& state) {
+  constexpr int kCatalog = 100000;
+  int page_size = static_cast<int>(state.range(1));
+  if (state.thread_index() == 0) {
+    SetUp(state, static_cast<Path>(state.range(0)));
+    AddProducts(kCatalog);
+  }
+  server::GetProductsRequest request;
+  request.set_page_size(static_cast<std::uint32_t>(page_size));
+  server::GetProductsResponse response;
+  std::minstd_rand rng(static_cast<unsigned>(state.thread_index()) + 1);
+  std::uniform_int_distribution<int> pick(0, kCatalog - page_size - 1);
+  std::int64_t failed = 0;
+
+  for (auto _ : state) {
+    request.set_page_token(std::to_string(g_product_ids[static_cast<std::size_t>(pick(rng))]));
+    failed += !Invoke(state, &AuctionService::GetProducts, &server::Auction::Stub::GetProducts,
+                      request, response) ||
+              response.products_size() != page_size;
+  }
+
+  state.SetItemsProcessed(state.iterations() * page_size);
+  if (failed != 0) {
+    state.SkipWithError("pages failed or were short");
+  }
+  if (state.thread_index() == 0) {
+    TearDown();
+  }
+}
+
+void BM_PlaceBid(benchmark::State& state) {
+  auto outcome = static_cast<BidOutcome>(state.range(1));
+  if (state.thread_index() == 0) {
+    SetUp(state, static_cast<Path>(state.range(0)));
+    AddProducts(state.threads());
+  }
+  server::PlaceBidRequest request;
+  request.set_bidder("bidder " + std::to_string(state.thread_index()));
+  server::PlaceBidResponse response;
+  // Each thread bids on its own product, so accepted bids never lose a race.
+  Cents amount = outcome == kOutbid ? kInitialPrice / 2 : kInitialPrice;
+  std::int64_t unexpected = 0;
+  bool set_up = false;
+
+  for (auto _ : state) {
+    if (!set_up) {
+      request.set_product_id(outcome == kNoSuchProduct
+                                 ? 1
+                                 : g_product_ids[static_cast<std::size_t>(state.thread_index())]);
+      set_up = true;
+    }
+    if (outcome == kAccepted) {
+      ++amount;
+    }
+    request.set_amount_cents(amount);
+    bool ok = Invoke(state, &AuctionService::PlaceBid, &server::Auction::Stub::PlaceBid, request,
+                     response);
+    unexpected += !ok || response.success() != (outcome == kAccepted);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  if (unexpected != 0) {
+    state.SkipWithError("bids did not end as expected");
+  }
+  if (state.thread_index() == 0) {
+    TearDown();
+  }
+}
+
+void BM_BidStream(benchmark::State& state) {
+  auto window = static_cast<std::int64_t>(state.range(0));
+  if (state.thread_index() == 0) {
+    SetUp(state, kInProcess);
+    AddProducts(state.threads());
+  }
+  server::BidStreamRequest request;
+  server::PlaceBidRequest* bid = request.mutable_bid();
+  bid->set_bidder("bidder " + std::to_string(state.thread_index()));
+  server::BidStreamResponse response;
+  grpc::ClientContext context;
+  std::unique_ptr<grpc::ClientReaderWriter<server::BidStreamRequest, server::BidStreamResponse>>
+      stream;
+  Cents amount = kInitialPrice;
+  std::int64_t in_flight = 0;
+  std::int64_t unexpected = 0;
+  auto read_results = [&] {
+    if (!stream->Read(&response)) {
+      return false;
+    }
+    for (const server::BidResult& result : response.results()) {
+      unexpected += !result.success();
+    }
+    in_flight -= response.results_size();
+    return true;
+  };
+
+  for (auto _ : state) {
+    if (stream == nullptr) {
+      g_open_streams.fetch_add(1);
+      stream = g_stubs[state.thread_index()]->BidStream(&context);
+      bid->set_product_id(g_product_ids[static_cast<std::size_t>(state.thread_index())]);
+    }
+    bid->set_amount_cents(++amount);
+    request.set_seq(static_cast<std::uint64_t>(amount));
+    // Only the bid that fills the window has to go out at once.
+    grpc::WriteOptions options;
+    if (in_flight + 1 < window) {
+      options.set_buffer_hint();
+    }
+    unexpected += !stream->Write(request, options);
+    ++in_flight;
+    while (in_flight >= window && read_results()) {
+    }
+  }
+  stream->WritesDone();
+  while (in_flight > 0 && read_results()) {
+  }
+  unexpected += in_flight != 0 || !stream->Finish().ok();
+  g_open_streams.fetch_sub(1);
+
+  state.SetItemsProcessed(state.iterations());
+  if (unexpected != 0) {
+    state.SkipWithError("bids did not end as expected");
+  }
+  if (state.thread_index() == 0) {
+    while (g_open_streams.load() != 0) {
+      std::this_thread::yield();
+    }
+    TearDown();
+  }
+}
+
+void BM_AddProducts(benchmark::State& state) {
+  int batch = static_cast<int>(state.range(1));
+  if (state.thread_index() == 0) {
+    SetUp(state, static_cast<Path>(state.range(0)));
+  }
+  server::AddProductsRequest request;
+  for (int i = 0; i < batch; ++i) {
+    server::AddProductRequest* product = request.add_products();
+    product->set_name("bench item");
+    product->set_initial_price_cents(kInitialPrice);
+    product->set_seller("seller " + std::to_string(state.thread_index()));
+  }
+  server::AddProductsResponse response;
+  std::int64_t failed = 0;
+
+  for (auto _ : state) {
+    failed += !Invoke(state, &AuctionService::AddProducts, &server::Auction::Stub::AddProducts,
+                      request, response) ||
+              response.results_size() != batch || !response.results(batch - 1).success();
+  }
+
+  state.SetItemsProcessed(state.iterations() * batch);
+  if (failed != 0) {
+    state.SkipWithError("inserts failed");
+  }
+  if (state.thread_index() == 0) {
+    TearDown();
+  }
+}
+
+void BM_PlaceBids(benchmark::State& state) {
+  int batch = static_cast<int>(state.range(1));
+  if (state.thread_index() == 0) {
+    SetUp(state, static_cast<Path>(state.range(0)));
+    AddProducts(state.threads());
+  }
+  server::PlaceBidsRequest request;
+  for (int i = 0; i < batch; ++i) {
+    request.add_bids()->set_bidder("bidder " + std::to_string(state.thread_index()));
+  }
+  server::PlaceBidsResponse response;
+  // Each thread bids on its own product, each bid above the one before it.
+  Cents amount = kInitialPrice;
+  std::int64_t unexpected = 0;
+  bool set_up = false;
+
+  for (auto _ : state) {
+    if (!set_up) {
+      for (server::PlaceBidRequest& bid : *request.mutable_bids()) {
+        bid.set_product_id(g_product_ids[static_cast<std::size_t>(state.thread_index())]);
+      }
+      set_up = true;
+    }
+    for (server::PlaceBidRequest& bid : *request.mutable_bids()) {
+      bid.set_amount_cents(++amount);
+    }
+    bool ok = Invoke(state, &AuctionService::PlaceBids, &server::Auction::Stub::PlaceBids,
+                     request, response);
+    unexpected += !ok || response.results_size() != batch;
+    for (const server::PlaceBidResponse& result : response.results()) {
+      unexpected += !result.success();
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * batch);
+  if (unexpected != 0) {
+    state.SkipWithError("bids did not end as expected");
+  }
+  if (state.thread_index() == 0) {
+    TearDown();
+  }
+}
+
+void BM_ImportProducts(benchmark::State& state) {
+  constexpr int kUpload = 100000;
+  int chunk_size = static_cast<int>(state.range(0));
+  if (state.thread_index() == 0) {
+    SetUp(state, kInProcess);
+  }
+  server::ImportProductsRequest chunk;
+  for (int i = 0; i < chunk_size; ++i) {
+    server::AddProductRequest* product = chunk.add_products();
+    product->set_name("bench item " + std::to_string(i));
+    product->set_initial_price_cents(kInitialPrice);
+    product->set_seller("seller " + std::to_string(state.thread_index()));
+  }
+  std::int64_t failed = 0;
+
+  for (auto _ : state) {
+    grpc::ClientContext context;
+    server::ImportProductsResponse response;
+    std::unique_ptr<grpc::ClientWriter<server::ImportProductsRequest>> upload =
+        g_stubs[state.thread_index()]->ImportProducts(&context, &response);
+    for (int sent = 0; sent < kUpload; sent += chunk_size) {
+      upload->Write(chunk);
+    }
+    upload->WritesDone();
+    failed += !upload->Finish().ok() || response.imported() != kUpload;
+  }
+
+  state.SetItemsProcessed(state.iterations() * kUpload);
+  if (failed != 0) {
+    state.SkipWithError("imports failed");
+  }
+  if (state.thread_index() == 0) {
+    TearDown();
+  }
+}
+
+BENCHMARK(BM_RegisterUser)->ArgName("path")->Arg(kDirect)->Arg(kInProcess)
+    ->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_AddProduct)->ArgName("path")->Arg(kDirect)->Arg(kInProcess)
+    ->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_GetProducts)
+    ->ArgNames({"path", "catalog"})
+    ->ArgsProduct({{kDirect, kInProcess}, {100, 1000, 10000, 100000}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_GetProductsPage)
+    ->ArgNames({"path", "page"})
+    ->ArgsProduct({{kDirect, kInProcess}, {10, 100, 1000}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_PlaceBid)
+    ->ArgNames({"path", "outcome"})
+    ->ArgsProduct({{kDirect, kInProcess}, {kAccepted, kOutbid, kNoSuchProduct}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_AddProducts)
+    ->ArgNames({"path", "batch"})
+    ->ArgsProduct({{kDirect, kInProcess}, {1, 16, 256}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_PlaceBids)
+    ->ArgNames({"path", "batch"})
+    ->ArgsProduct({{kDirect, kInProcess}, {1, 16, 256}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_ImportProducts)->ArgName("chunk")->Arg(100)->Arg(1000)->Arg(10000)
+    ->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_BidStream)->ArgName("window")->Arg(1)->Arg(16)->Arg(128)
+    ->ThreadRange(1, 8)->UseRealTime();
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  LoggerOptions log_options;
+  log_options.fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+  Logger::Start(log_options);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  Logger::Stop();
+  ::close(log_options.fd);
+  return 0;
+}
@@ -0,0 +1,175 @@
+// PlaceBid throughput over a real loopback connection for each server mode:
+// the synchronous service, AsyncAuctionServer with its defaults (one pinned
+// poller per core) and CallbackAuctionService. Client threads each have
+// their own channel and bid on their own product.
+//
+// With log:0 there is no write-ahead log, so the RPC layer is what is
+// measured. With log:1 every bid waits for an fdatasync'd batch; the modes
+// that hold a thread per waiting bid batch fewer bids per sync.
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <grpcpp/grpcpp.h>
+#include "async_server.h"
+#include "auction_service.h"
+#include "callback_service.h"
+
+namespace {
+
+constexpr int kMaxClients = 64;
+
+enum Mode { kSync, kAsync, kCallback };
+
+std::string g_dir;
+std::unique_ptr<WriteAheadLog> g_wal;
+std::unique_ptr<AuctionService> g_service;
+std::unique_ptr<AsyncAuctionServer> g_async_server;
+std::unique_ptr<CallbackAuctionService> g_callback_service;
+std::unique_ptr<grpc::Server> g_server;
+std::string g_target;
+std::vector<ProductId> g_product_ids;
+
+void RemoveSegments() {
+  for (std::uint64_t segment : WriteAheadLog::ListSegments(g_dir)) {
+    std::remove(WriteAheadLog::SegmentPath(g_dir, segment).c_str());
+  }
+}
+
+bool StartServer(Mode mode, bool logged) {
+  g_service = std::make_unique<AuctionService>();
+  if (logged) {
+    RemoveSegments();
+    WalOptions options;
+    options.dir = g_dir;
+    g_wal = std::make_unique<WriteAheadLog>(options);
+    std::string error;
+    if (!g_wal->Open(&error)) {
+      std::cerr << "Cannot open write-ahead log: " << error << std::endl;
+      return false;
+    }
+    g_service->SetWriteAheadLog(g_wal.get());
+  }
+
+  grpc::ServerBuilder builder;
+  int port = 0;
+  builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+  switch (mode) {
+    case kSync:
+      builder.RegisterService(g_service.get());
+      break;
+    case kAsync:
+      g_async_server = std::make_unique<AsyncAuctionServer>(*g_service, AsyncServerOptions());
+      g_async_server->Register(builder);
+      break;
+    case kCallback:
+      g_callback_service = std::make_unique<CallbackAuctionService>(*g_service);
+      builder.RegisterService(g_callback_service.get());
+      break;
+  }
+  g_server = builder.BuildAndStart();
+  if (g_async_server != nullptr) {
+    g_async_server->Start();
+  }
+  g_target = "127.0.0.1:" + std::to_string(port);
+
+  g_product_ids.clear();
+  for (int i = 0; i < kMaxClients; ++i) {
+    server::AddProductRequest request;
+    request.set_name("bench item " + std::to_string(i));
+    request.set_initial_price_cents(100);
+    request.set_seller("bench");
+    server::AddProductResponse response;
+    g_service->AddProduct(nullptr, &request, &response);
+    g_product_ids.push_back(response.product_id());
+  }
+  return true;
+}
+
+void StopServer() {
+  if (g_server != nullptr) {
+    g_server->Shutdown();
+  }
+  if (g_async_server != nullptr) {
+    g_async_server->Shutdown();
+  }
+  g_server.reset();
+  g_async_server.reset();
+  g_callback_service.reset();
+  if (g_wal != nullptr) {
+    g_wal->Close();
+  }
+  g_service.reset();
+  g_wal.reset();
+}
+
+void BM_PlaceBidOverGrpc(benchmark::State& state) {
+  if (state.thread_index() == 0 &&
+      !StartServer(static_cast<Mode>(state.range(0)), state.range(1) != 0)) {
+    state.SkipWithError("server did not start");
+  }
+
+  std::unique_ptr<server::Auction::Stub> stub;
+  server::PlaceBidRequest request;
+  request.set_bidder("bidder" + std::to_string(state.thread_index()));
+  server::PlaceBidResponse response;
+  Cents amount = 100;
+  std::int64_t failed = 0;
+
+  for (auto _ : state) {
+    if (g_server == nullptr) {
+      break;
+    }
+    if (stub == nullptr) {
+      // A channel per client, so clients do not share one HTTP/2 connection.
+      grpc::ChannelArguments args;
+      args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+      stub = server::Auction::NewStub(
+          grpc::CreateCustomChannel(g_target, grpc::InsecureChannelCredentials(), args));
+      request.set_product_id(g_product_ids[state.thread_index() % kMaxClients]);
+    }
+    request.set_amount_cents(++amount);
+    grpc::ClientContext context;
+    grpc::Status status = stub->PlaceBid(&context, request, &response);
+    failed += !status.ok() || !response.success();
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  if (failed != 0) {
+    state.SkipWithError("bids failed");
+  }
+  stub.reset();
+  if (state.thread_index() == 0) {
+    StopServer();
+  }
+}
+
+BENCHMARK(BM_PlaceBidOverGrpc)
+    ->ArgNames({"mode", "log"})
+    ->ArgsProduct({{kSync, kAsync, kCallback}, {0, 1}})
+    ->ThreadRange(1, kMaxClients)
+    ->UseRealTime();
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  char dir[] = "/tmp/server_mode_bench.XXXXXX";
+  if (::mkdtemp(dir) == nullptr) {
+    std::cerr << "mkdtemp failed" << std::endl;
+    return 1;
+  }
+  g_dir = dir;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  RemoveSegments();
+  ::rmdir(dir);
+  return 0;
+}
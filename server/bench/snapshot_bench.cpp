@@ -0,0 +1,133 @@
+// Restart cost with snapshots: how long writing a snapshot of a large catalog
+// takes, and how long a fresh server takes to map and verify it before it can
+// serve. Bids are spread round-robin over the products, all accepted.
+//
+// The 1M product / 50M bid case needs about 4 GB of memory and builds its
+// catalog through PlaceBid first, which takes a while; filter it out with
+// --benchmark_filter=products:100000/ for a quick run.
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "auction_service.h"
+
+namespace {
+
+constexpr int kBidders = 10000;
+
+std::string g_dir;
+std::unique_ptr<AuctionService> g_service;
+std::int64_t g_products = 0;
+std::int64_t g_bids = 0;
+
+std::string SnapshotPath() {
+  return g_dir + "/snapshot.bin";
+}
+
+// Builds the catalog once per argument pair and keeps a snapshot of it.
+void BuildCatalog(benchmark::State& state) {
+  if (g_service != nullptr && g_products == state.range(0) && g_bids == state.range(1)) {
+    return;
+  }
+  g_service.reset();
+  g_products = state.range(0);
+  g_bids = state.range(1);
+  g_service = std::make_unique<AuctionService>();
+
+  std::vector<ProductId> ids;
+  ids.reserve(static_cast<std::size_t>(g_products));
+  server::AddProductRequest add;
+  add.set_initial_price_cents(100);
+  add.set_seller("seller");
+  server::AddProductResponse added;
+  for (std::int64_t i = 0; i < g_products; ++i) {
+    add.set_name("item " + std::to_string(i));
+    g_service->AddProduct(nullptr, &add, &added);
+    ids.push_back(added.product_id());
+  }
+
+  server::PlaceBidRequest bid;
+  server::PlaceBidResponse placed;
+  for (std::int64_t i = 0; i < g_bids; ++i) {
+    bid.set_product_id(ids[static_cast<std::size_t>(i % g_products)]);
+    bid.set_bidder("bidder" + std::to_string(i % kBidders));
+    bid.set_amount_cents(101 + i / g_products);
+    g_service->PlaceBid(nullptr, &bid, &placed);
+  }
+
+  std::string error;
+  if (!g_service->WriteSnapshot(SnapshotPath(), nullptr, nullptr, &error)) {
+    state.SkipWithError(error.c_str());
+  }
+}
+
+void BM_WriteSnapshot(benchmark::State& state) {
+  BuildCatalog(state);
+  std::string error;
+  for (auto _ : state) {
+    if (!g_service->WriteSnapshot(SnapshotPath(), nullptr, nullptr, &error)) {
+      state.SkipWithError(error.c_str());
+      break;
+    }
+  }
+  state.counters["bids"] = static_cast<double>(g_bids);
+}
+
+void BM_LoadSnapshot(benchmark::State& state) {
+  BuildCatalog(state);
+  std::string error;
+  WriteAheadLog::Position wal_start;
+  for (auto _ : state) {
+    auto restored = std::make_unique<AuctionService>();
+    auto started = std::chrono::steady_clock::now();
+    bool ok = restored->LoadSnapshot(SnapshotPath(), &wal_start, &error);
+    auto elapsed = std::chrono::steady_clock::now() - started;
+    state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+    if (!ok || restored->BidCount() != g_service->BidCount()) {
+      state.SkipWithError(ok ? "restored bid count differs" : error.c_str());
+      break;
+    }
+    // Tearing the service down is not part of startup.
+  }
+  state.counters["bids"] = static_cast<double>(g_bids);
+}
+
+void CatalogArgs(benchmark::internal::Benchmark* bench) {
+  bench->ArgNames({"products", "bids"})
+      ->Args({100000, 5000000})
+      ->Args({1000000, 50000000})
+      ->Unit(benchmark::kMillisecond)
+      ->Iterations(3);
+}
+
+BENCHMARK(BM_WriteSnapshot)->Apply(CatalogArgs)->UseRealTime();
+BENCHMARK(BM_LoadSnapshot)->Apply(CatalogArgs)->UseManualTime();
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+
+  char dir_template[] = "/tmp/snapshot_bench.XXXXXX";
+  if (::mkdtemp(dir_template) == nullptr) {
+    std::cerr << "Cannot create a scratch directory" << std::endl;
+    return 1;
+  }
+  g_dir = dir_template;
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  g_service.reset();
+  std::remove(SnapshotPath().c_str());
+  ::rmdir(g_dir.c_str());
+  return 0;
+}
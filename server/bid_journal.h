@@ -0,0 +1,86 @@
+#ifndef BID_JOURNAL_H
+#define BID_JOURNAL_H
+
+#include <chrono>
+#include <cstdint>
+#include "money.h"
+#include "product_id.h"
+#include "segmented_array.h"
+
+using BidIndex = std::uint32_t;
+
+// End of a product's chain.
+constexpr BidIndex kNoBid = 0xFFFFFFFFu;
+// Marks a record whose bid was outbid between being appended and being
+// linked into its product's chain. Such records belong to no chain.
+constexpr BidIndex kVoidBid = 0xFFFFFFFEu;
+
+// One accepted bid. A record's index in the journal is its global sequence
+// number; `previous` links it to the bid it beat on the same product.
+struct BidRecord {
+  std::uint32_t product;    // dense product index, see Product::index
+  std::uint32_t bidder;     // interned nickname, see InternTable
+  Cents amount;
+  BidIndex previous;        // kNoBid for a product's first bid, or kVoidBid
+  std::uint32_t placed_at;  // seconds since kProductIdEpochMs
+};
+static_assert(sizeof(BidRecord) == 24, "bid records are packed to 24 bytes");
+
+// Append-only log of every bid, stored in 1.5 MB segments so appending never
+// moves earlier records. Each product's bids form a chain through
+// BidRecord::previous, newest first, so one product's history is walked
+// without scanning the rest of the journal.
+class BidJournal {
+public:
+  // Seconds since kProductIdEpochMs, the unit of BidRecord::placed_at.
+  static std::uint32_t NowSeconds() {
+    std::uint64_t ms = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    return static_cast<std::uint32_t>((ms - kProductIdEpochMs) / 1000);
+  }
+
+  // Reserves and fills a record; returns kNoBid if the journal is full.
+  BidIndex Append(std::uint32_t product, std::uint32_t bidder, Cents amount,
+                  BidIndex previous, std::uint32_t placed_at = NowSeconds()) {
+    BidIndex index = records_.Append();
+    if (index == records_.kFull) {
+      return kNoBid;
+    }
+    BidRecord& record = records_[index];
+    record.product = product;
+    record.bidder = bidder;
+    record.amount = amount;
+    record.previous = previous;
+    record.placed_at = placed_at;
+    return index;
+  }
+
+  // Allocates room for `count` records up front; see SegmentedArray::Reserve.
+  void Reserve(std::uint32_t count) { records_.Reserve(count); }
+
+  // Serves the first `count` records from `records`, e.g. a mapped snapshot,
+  // which must outlive the journal. Call on an empty journal.
+  void Adopt(BidRecord* records, std::uint32_t count) { records_.Adopt(records, count); }
+
+  BidRecord& operator[](BidIndex index) { return records_[index]; }
+  const BidRecord& operator[](BidIndex index) const { return records_[index]; }
+
+  // Calls fn(index, record) for each bid on the chain starting at `head`,
+  // newest first.
+  template <typename Fn>
+  void ForEachInChain(BidIndex head, Fn&& fn) const {
+    for (BidIndex index = head; index != kNoBid; index = records_[index].previous) {
+      fn(index, records_[index]);
+    }
+  }
+
+  // Records appended so far, including void ones.
+  std::uint32_t size() const { return records_.size(); }
+  std::size_t MemoryBytes() const { return records_.MemoryBytes(); }
+
+private:
+  SegmentedArray<BidRecord> records_;
+};
+
+#endif // BID_JOURNAL_H
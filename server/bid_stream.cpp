@@ -0,0 +1,173 @@
+#include "bid_stream.h"
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include "auction_service.h"
+#include "tracer.h"
+
+using server::BidStreamRequest;
+using server::BidStreamResponse;
+
+namespace {
+
+// Results read but not yet written past which the session stops reading.
+constexpr std::size_t kMaxPendingResults = 1024;
+
+class BidSession final : public grpc::ServerBidiReactor<BidStreamRequest, BidStreamResponse> {
+public:
+  explicit BidSession(AuctionService& service) : service_(service) {}
+
+  // `self` keeps the session alive until gRPC and the log are done with it.
+  void Start(std::shared_ptr<BidSession> self) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    self_ = std::move(self);
+    pump(lock);
+  }
+
+  void OnReadDone(bool ok) override {
+    if (!ok) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      reading_ = false;
+      reads_done_ = true;
+      pump(lock);
+      return;
+    }
+    RpcTimer timer(RpcMethod::kBidStream);
+    server::PlaceBidResponse response;
+    WriteAheadLog::Lsn durable_at;
+    {
+      TraceRequest trace("BidStream");
+      service_.ApplyPlaceBid(&request_.bid(), &response, &durable_at);
+    }
+    timer.Mark(RpcPhase::kHandler);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    reading_ = false;
+    pending_.push_back({request_.seq(), response.success(), durable_at, timer});
+    // A session's records become durable in the order it appended them, so
+    // waiting for the newest covers every one before it.
+    last_lsn_ = std::max(last_lsn_, durable_at);
+    pump(lock);
+  }
+
+  void OnWriteDone(bool ok) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    writing_ = false;
+    if (!ok && status_.ok()) {
+      status_ = grpc::Status::CANCELLED;
+    }
+    pump(lock);
+  }
+
+  void OnDone() override {
+    // The last reference may be this one; nothing may follow it.
+    std::shared_ptr<BidSession> self = std::move(self_);
+  }
+
+private:
+  struct Pending {
+    std::uint64_t seq;
+    bool success;
+    WriteAheadLog::Lsn durable_at;  // 0 if there is nothing to wait for
+    RpcTimer timer;
+  };
+
+  void onDurable(WriteAheadLog::Lsn lsn, grpc::Status status) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    waiting_ = false;
+    if (!status.ok()) {
+      if (status_.ok()) {
+        status_ = std::move(status);
+      }
+    } else {
+      durable_lsn_ = std::max(durable_lsn_, lsn);
+    }
+    pump(lock);
+  }
+
+  // Starts whatever can start: a write of the results that are ready, the
+  // next read, a wait on the log, or finishing the call. Called with the
+  // lock held, which it releases.
+  void pump(std::unique_lock<std::mutex>& lock) {
+    if (finished_) {
+      return;
+    }
+    if (!status_.ok() || (reads_done_ && pending_.empty())) {
+      // Nothing more will be written, but a write in flight must end first.
+      if (writing_) {
+        return;
+      }
+      finished_ = true;
+      grpc::Status status = status_;
+      lock.unlock();
+      Finish(status);
+      return;
+    }
+
+    bool write = false;
+    if (!writing_) {
+      response_.clear_results();
+      while (!pending_.empty() && pending_.front().durable_at <= durable_lsn_) {
+        Pending& result = pending_.front();
+        server::BidResult* sent = response_.add_results();
+        sent->set_seq(result.seq);
+        sent->set_success(result.success);
+        if (result.durable_at != 0) {
+          result.timer.Mark(RpcPhase::kLogWait);
+        }
+        result.timer.Finish();
+        pending_.pop_front();
+      }
+      write = writing_ = response_.results_size() != 0;
+    }
+    bool read = !reading_ && !reads_done_ && pending_.size() < kMaxPendingResults;
+    reading_ = reading_ || read;
+    WriteAheadLog::Lsn wait_for = 0;
+    std::shared_ptr<BidSession> self;
+    if (!waiting_ && last_lsn_ > durable_lsn_) {
+      waiting_ = true;
+      wait_for = last_lsn_;
+      self = self_;
+    }
+    lock.unlock();
+
+    if (write) {
+      StartWrite(&response_);
+    }
+    if (read) {
+      StartRead(&request_);
+    }
+    if (wait_for != 0) {
+      service_.WhenDurable(wait_for, [self, wait_for](grpc::Status status) {
+        self->onDurable(wait_for, std::move(status));
+      });
+    }
+  }
+
+  AuctionService& service_;
+  BidStreamRequest request_;  // only touched by the read in flight
+
+  std::mutex mutex_;  // guards everything below
+  BidStreamResponse response_;
+  std::deque<Pending> pending_;
+  WriteAheadLog::Lsn last_lsn_ = 0;     // newest record appended
+  WriteAheadLog::Lsn durable_lsn_ = 0;  // newest record known durable
+  bool reading_ = false;
+  bool writing_ = false;
+  bool waiting_ = false;  // on the log, for last_lsn_ as it was then
+  bool reads_done_ = false;
+  bool finished_ = false;
+  grpc::Status status_;
+  std::shared_ptr<BidSession> self_;
+};
+
+}  // namespace
+
+grpc::ServerBidiReactor<BidStreamRequest, BidStreamResponse>* StartBidStream(
+    AuctionService& service) {
+  auto session = std::make_shared<BidSession>(service);
+  BidSession* reactor = session.get();
+  reactor->Start(std::move(session));
+  return reactor;
+}
@@ -0,0 +1,19 @@
+#ifndef BID_STREAM_H
+#define BID_STREAM_H
+
+#include <grpcpp/grpcpp.h>
+#include "e-space.grpc.pb.h"
+
+class AuctionService;
+
+// The BidStream handler, for every server mode. Bids are applied as they
+// are read, without waiting for earlier ones to become durable, and their
+// results are written in the order the bids came, each once its log record
+// is durable. Every result ready when a write can start goes into that
+// write, so a group commit's worth of bids costs one message. Reading
+// pauses while too many results are waiting, which pushes back on a client
+// that sends faster than the log syncs.
+grpc::ServerBidiReactor<server::BidStreamRequest, server::BidStreamResponse>* StartBidStream(
+    AuctionService& service);
+
+#endif // BID_STREAM_H
@@ -0,0 +1,107 @@
+#include "callback_service.h"
+#include "tracer.h"
+
+using grpc::CallbackServerContext;
+using grpc::ServerUnaryReactor;
+
+ServerUnaryReactor* CallbackAuctionService::RegisterUser(
+    CallbackServerContext* context, const server::RegisterUserRequest* request,
+    server::RegisterUserResponse* response) {
+  RpcTimer timer(RpcMethod::kRegisterUser);
+  TraceRequest trace("RegisterUser");
+  WriteAheadLog::Lsn durable_at;
+  service_.ApplyRegisterUser(request, response, &durable_at);
+  timer.Mark(RpcPhase::kHandler);
+  return finishWhenDurable(context, durable_at, timer);
+}
+
+ServerUnaryReactor* CallbackAuctionService::AddProduct(CallbackServerContext* context,
+                                                       const server::AddProductRequest* request,
+                                                       server::AddProductResponse* response) {
+  RpcTimer timer(RpcMethod::kAddProduct);
+  TraceRequest trace("AddProduct");
+  WriteAheadLog::Lsn durable_at;
+  service_.ApplyAddProduct(request, response, &durable_at);
+  timer.Mark(RpcPhase::kHandler);
+  return finishWhenDurable(context, durable_at, timer);
+}
+
+ServerUnaryReactor* CallbackAuctionService::GetProducts(
+    CallbackServerContext* context, const server::GetProductsRequest* request,
+    server::GetProductsResponse* response) {
+  // The sync handlers for reads never block and do not use their context.
+  ServerUnaryReactor* reactor = context->DefaultReactor();
+  reactor->Finish(service_.GetProducts(nullptr, request, response));
+  return reactor;
+}
+
+ServerUnaryReactor* CallbackAuctionService::PlaceBid(CallbackServerContext* context,
+                                                     const server::PlaceBidRequest* request,
+                                                     server::PlaceBidResponse* response) {
+  RpcTimer timer(RpcMethod::kPlaceBid);
+  TraceRequest trace("PlaceBid");
+  WriteAheadLog::Lsn durable_at;
+  service_.ApplyPlaceBid(request, response, &durable_at);
+  timer.Mark(RpcPhase::kHandler);
+  return finishWhenDurable(context, durable_at, timer);
+}
+
+ServerUnaryReactor* CallbackAuctionService::AddProducts(
+    CallbackServerContext* context, const server::AddProductsRequest* request,
+    server::AddProductsResponse* response) {
+  RpcTimer timer(RpcMethod::kAddProducts);
+  TraceRequest trace("AddProducts");
+  WriteAheadLog::Lsn durable_at;
+  Status status = service_.ApplyAddProducts(request, response, &durable_at);
+  timer.Mark(RpcPhase::kHandler);
+  return finishWhenDurable(context, status, durable_at, timer);
+}
+
+ServerUnaryReactor* CallbackAuctionService::PlaceBids(CallbackServerContext* context,
+                                                      const server::PlaceBidsRequest* request,
+                                                      server::PlaceBidsResponse* response) {
+  RpcTimer timer(RpcMethod::kPlaceBids);
+  TraceRequest trace("PlaceBids");
+  WriteAheadLog::Lsn durable_at;
+  Status status = service_.ApplyPlaceBids(request, response, &durable_at);
+  timer.Mark(RpcPhase::kHandler);
+  return finishWhenDurable(context, status, durable_at, timer);
+}
+
+ServerUnaryReactor* CallbackAuctionService::GetServerStats(
+    CallbackServerContext* context, const server::GetServerStatsRequest* request,
+    server::GetServerStatsResponse* response) {
+  ServerUnaryReactor* reactor = context->DefaultReactor();
+  reactor->Finish(service_.GetServerStats(nullptr, request, response));
+  return reactor;
+}
+
+ServerUnaryReactor* CallbackAuctionService::DumpTrace(CallbackServerContext* context,
+                                                      const server::DumpTraceRequest* request,
+                                                      server::DumpTraceResponse* response) {
+  ServerUnaryReactor* reactor = context->DefaultReactor();
+  reactor->Finish(service_.DumpTrace(nullptr, request, response));
+  return reactor;
+}
+
+ServerUnaryReactor* CallbackAuctionService::finishWhenDurable(CallbackServerContext* context,
+                                                              const Status& status,
+                                                              WriteAheadLog::Lsn durable_at,
+                                                              RpcTimer timer) {
+  if (status.ok()) {
+    return finishWhenDurable(context, durable_at, timer);
+  }
+  timer.Finish();
+  ServerUnaryReactor* reactor = context->DefaultReactor();
+  reactor->Finish(status);
+  return reactor;
+}
+
+ServerUnaryReactor* CallbackAuctionService::finishWhenDurable(CallbackServerContext* context,
+                                                              WriteAheadLog::Lsn durable_at,
+                                                              RpcTimer timer) {
+  ServerUnaryReactor* reactor = context->DefaultReactor();
+  service_.WhenDurable(durable_at, timer,
+                       [reactor](Status status) { reactor->Finish(status); });
+  return reactor;
+}
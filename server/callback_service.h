@@ -0,0 +1,78 @@
+#ifndef CALLBACK_SERVICE_H
+#define CALLBACK_SERVICE_H
+
+#include <grpcpp/grpcpp.h>
+#include "auction_service.h"
+
+// Serves AuctionService through the gRPC callback API. Each handler applies
+// its request on the calling gRPC thread and returns; a mutation's response
+// is finished from the log's writer thread once its record is durable. A bid
+// waiting on the disk therefore holds no thread, and the number in flight is
+// bounded by memory rather than by a thread pool.
+class CallbackAuctionService final
+    : public server::Auction::WithRawCallbackMethod_WatchProducts<
+          server::Auction::CallbackService> {
+public:
+  explicit CallbackAuctionService(AuctionService& service) : service_(service) {}
+
+  grpc::ServerUnaryReactor* RegisterUser(grpc::CallbackServerContext* context,
+                                         const server::RegisterUserRequest* request,
+                                         server::RegisterUserResponse* response) override;
+
+  grpc::ServerUnaryReactor* AddProduct(grpc::CallbackServerContext* context,
+                                       const server::AddProductRequest* request,
+                                       server::AddProductResponse* response) override;
+
+  grpc::ServerUnaryReactor* GetProducts(grpc::CallbackServerContext* context,
+                                        const server::GetProductsRequest* request,
+                                        server::GetProductsResponse* response) override;
+
+  grpc::ServerUnaryReactor* PlaceBid(grpc::CallbackServerContext* context,
+                                     const server::PlaceBidRequest* request,
+                                     server::PlaceBidResponse* response) override;
+
+  grpc::ServerUnaryReactor* AddProducts(grpc::CallbackServerContext* context,
+                                        const server::AddProductsRequest* request,
+                                        server::AddProductsResponse* response) override;
+
+  grpc::ServerUnaryReactor* PlaceBids(grpc::CallbackServerContext* context,
+                                      const server::PlaceBidsRequest* request,
+                                      server::PlaceBidsResponse* response) override;
+
+  grpc::ServerUnaryReactor* GetServerStats(grpc::CallbackServerContext* context,
+                                           const server::GetServerStatsRequest* request,
+                                           server::GetServerStatsResponse* response) override;
+
+  grpc::ServerUnaryReactor* DumpTrace(grpc::CallbackServerContext* context,
+                                      const server::DumpTraceRequest* request,
+                                      server::DumpTraceResponse* response) override;
+
+  grpc::ServerWriteReactor<grpc::ByteBuffer>* WatchProducts(
+      grpc::CallbackServerContext* context, const grpc::ByteBuffer* request) override {
+    return service_.WatchProducts(context, request);
+  }
+
+  grpc::ServerBidiReactor<server::BidStreamRequest, server::BidStreamResponse>* BidStream(
+      grpc::CallbackServerContext* context) override {
+    return service_.BidStream(context);
+  }
+
+  grpc::ServerReadReactor<server::ImportProductsRequest>* ImportProducts(
+      grpc::CallbackServerContext* context, server::ImportProductsResponse* response) override {
+    return service_.ImportProducts(context, response);
+  }
+
+private:
+  // Finishes the call with `status` if it failed, else once `durable_at` is
+  // durable.
+  grpc::ServerUnaryReactor* finishWhenDurable(grpc::CallbackServerContext* context,
+                                              const Status& status,
+                                              WriteAheadLog::Lsn durable_at, RpcTimer timer);
+  // Finishes the call once `durable_at` is durable.
+  grpc::ServerUnaryReactor* finishWhenDurable(grpc::CallbackServerContext* context,
+                                              WriteAheadLog::Lsn durable_at, RpcTimer timer);
+
+  AuctionService& service_;
+};
+
+#endif // CALLBACK_SERVICE_H
@@ -0,0 +1,132 @@
+#ifndef CHANGE_INDEX_H
+#define CHANGE_INDEX_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// The newest catalog version changed in each block of 64 product slots and
+// in each group of 64 blocks, so that a since_version listing skips whole
+// groups and blocks nothing changed in, instead of reading every product.
+// A refresh where one product of a million changed reads 256 group
+// summaries, then 64 block summaries and 64 products.
+//
+// A change is bracketed like Product::version's: BeginChange() before the
+// version is taken, EndChange() once it is known. Meanwhile the slot's block
+// and group count as changed, as the product does.
+class ChangeIndex {
+public:
+  static constexpr int kBlockBits = 6;
+  static constexpr int kGroupBits = 12;
+  static constexpr std::uint32_t kBlocksPerGroup = 1u << (kGroupBits - kBlockBits);
+
+  // For slots below `capacity`.
+  explicit ChangeIndex(std::uint32_t capacity)
+      : max_groups_(static_cast<std::uint32_t>(
+            (static_cast<std::uint64_t>(capacity) + (1u << kGroupBits) - 1) >> kGroupBits)),
+        groups_(new std::atomic<Group*>[max_groups_]) {
+    for (std::uint32_t i = 0; i < max_groups_; ++i) {
+      groups_[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~ChangeIndex() {
+    for (std::uint32_t i = 0; i < max_groups_; ++i) {
+      delete groups_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  ChangeIndex(const ChangeIndex&) = delete;
+  ChangeIndex& operator=(const ChangeIndex&) = delete;
+
+  // Only allocates for the first change in a group.
+  void BeginChange(std::uint32_t slot) {
+    Group& group = ensureGroup(slot >> kGroupBits);
+    group.summary.stamping.fetch_add(1, std::memory_order_relaxed);
+    group.blocks[blockIndex(slot)].stamping.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void EndChange(std::uint32_t slot, std::uint64_t version) {
+    Group& group = *groups_[slot >> kGroupBits].load(std::memory_order_acquire);
+    group.blocks[blockIndex(slot)].End(version);
+    group.summary.End(version);
+  }
+
+  // The first slot from `slot` up to `end` that may have changed after
+  // version `since`, or `end`. Read the catalog version before calling, as
+  // for Product::version: a change up to it is either stamped or counted.
+  std::uint32_t NextChanged(std::uint32_t slot, std::uint32_t end, std::uint64_t since) const {
+    while (slot < end) {
+      const Group* group = groups_[slot >> kGroupBits].load(std::memory_order_acquire);
+      if (group == nullptr || !group->summary.ChangedAfter(since)) {
+        slot = nextBoundary(slot, kGroupBits);
+      } else if (!group->blocks[blockIndex(slot)].ChangedAfter(since)) {
+        slot = nextBoundary(slot, kBlockBits);
+      } else {
+        return slot;
+      }
+    }
+    return end;
+  }
+
+  std::size_t MemoryBytes() const {
+    return group_count_.load(std::memory_order_relaxed) * sizeof(Group) +
+           max_groups_ * sizeof(std::atomic<Group*>);
+  }
+
+private:
+  struct Summary {
+    std::atomic<std::uint64_t> version{0};
+    std::atomic<std::uint32_t> stamping{0};
+
+    void End(std::uint64_t changed) {
+      std::uint64_t stamped = version.load(std::memory_order_relaxed);
+      while (stamped < changed &&
+             !version.compare_exchange_weak(stamped, changed, std::memory_order_relaxed)) {
+      }
+      stamping.fetch_sub(1, std::memory_order_release);
+    }
+
+    bool ChangedAfter(std::uint64_t since) const {
+      return stamping.load(std::memory_order_acquire) != 0 ||
+             version.load(std::memory_order_acquire) > since;
+    }
+  };
+
+  struct Group {
+    Summary summary;
+    Summary blocks[kBlocksPerGroup];
+  };
+
+  static std::uint32_t blockIndex(std::uint32_t slot) {
+    return (slot >> kBlockBits) & (kBlocksPerGroup - 1);
+  }
+
+  // The start of the next block or group after `slot`, saturating at the
+  // top of the slot range.
+  static std::uint32_t nextBoundary(std::uint32_t slot, int bits) {
+    std::uint64_t next = ((static_cast<std::uint64_t>(slot) >> bits) + 1) << bits;
+    return next > 0xFFFFFFFFu ? 0xFFFFFFFFu : static_cast<std::uint32_t>(next);
+  }
+
+  Group& ensureGroup(std::uint32_t index) {
+    Group* group = groups_[index].load(std::memory_order_acquire);
+    if (group != nullptr) {
+      return *group;
+    }
+    Group* fresh = new Group();
+    if (!groups_[index].compare_exchange_strong(group, fresh, std::memory_order_acq_rel)) {
+      delete fresh;  // another thread installed it first
+      return *group;
+    }
+    group_count_.fetch_add(1, std::memory_order_relaxed);
+    return *fresh;
+  }
+
+  const std::uint32_t max_groups_;
+  std::unique_ptr<std::atomic<Group*>[]> groups_;
+  std::atomic<std::uint32_t> group_count_{0};
+};
+
+#endif // CHANGE_INDEX_H
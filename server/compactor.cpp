@@ -0,0 +1,217 @@
+#include "compactor.h"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "logger.h"
+#include "rate_limiter.h"
+#include "tracer.h"
+
+namespace {
+
+const char kManifestName[] = "MANIFEST";
+
+std::string SnapshotName(std::uint64_t number) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "snapshot-%06" PRIu64 ".bin", number);
+  return name;
+}
+
+// Snapshot numbers present in `dir`.
+std::vector<std::uint64_t> ListSnapshots(const std::string& dir) {
+  std::vector<std::uint64_t> snapshots;
+  DIR* handle = ::opendir(dir.c_str());
+  if (handle == nullptr) {
+    return snapshots;
+  }
+  while (dirent* entry = ::readdir(handle)) {
+    std::uint64_t number;
+    char tail;
+    if (std::sscanf(entry->d_name, "snapshot-%" SCNu64 ".bi%c", &number, &tail) == 2 &&
+        tail == 'n' && SnapshotName(number) == entry->d_name) {
+      snapshots.push_back(number);
+    }
+  }
+  ::closedir(handle);
+  return snapshots;
+}
+
+// Deletes `path`, adding its size to `reclaimed`.
+void RemoveFile(const std::string& path, std::uint64_t& reclaimed) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) == 0 && ::unlink(path.c_str()) == 0) {
+    reclaimed += static_cast<std::uint64_t>(st.st_size);
+  }
+}
+
+}  // namespace
+
+Compactor::Compactor(AuctionService& service, WriteAheadLog& wal, CompactionOptions options)
+    : service_(service), wal_(wal), options_(std::move(options)) {}
+
+Compactor::~Compactor() {
+  Stop();
+}
+
+void Compactor::Start() {
+  thread_ = std::thread(&Compactor::run, this);
+}
+
+void Compactor::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  stop_cond_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+CompactionStats Compactor::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void Compactor::run() {
+  Tracer::SetThreadName("compactor");
+  auto last_pass = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_cond_.wait_for(lock, std::chrono::seconds(1), [&] { return stopping_; })) {
+    std::uint64_t written = wal_.stats().bytes - compacted_log_bytes_;
+    bool due = written >= options_.log_bytes_trigger ||
+               (written != 0 && options_.interval.count() != 0 &&
+                std::chrono::steady_clock::now() - last_pass >= options_.interval);
+    if (!due) {
+      continue;
+    }
+    lock.unlock();
+    std::string error;
+    if (!CompactNow(&error)) {
+      Log(LogLevel::kError, "Compaction failed: {}", error);
+    }
+    last_pass = std::chrono::steady_clock::now();
+    lock.lock();
+  }
+}
+
+bool Compactor::CompactNow(std::string* error) {
+  std::lock_guard<std::mutex> pass_lock(pass_mutex_);
+  // Passes are rare and long, so every one is traced while tracing is on.
+  TraceRequest trace("compaction", Tracer::Enabled());
+  auto started = std::chrono::steady_clock::now();
+  std::uint64_t log_bytes = wal_.stats().bytes;
+
+  std::vector<std::uint64_t> snapshots = ListSnapshots(options_.dir);
+  std::uint64_t number = 1;
+  for (std::uint64_t existing : snapshots) {
+    number = std::max(number, existing + 1);
+  }
+  std::string name = SnapshotName(number);
+  RateLimiter limiter(options_.max_bytes_per_second);
+  WriteAheadLog::Position covered;
+  {
+    TraceSpan span("write_snapshot");
+    if (!service_.WriteSnapshot(options_.dir + "/" + name, &limiter, &covered, error)) {
+      return false;
+    }
+  }
+  {
+    TraceSpan span("write_manifest");
+    if (!writeManifest(name, error)) {
+      return false;
+    }
+  }
+
+  // MANIFEST now names the new snapshot, so everything it covers can go. The
+  // snapshot this process started from stays mapped, so its blocks are only
+  // freed at exit.
+  std::uint64_t reclaimed = 0;
+  {
+    TraceSpan span("remove_covered");
+    for (std::uint64_t existing : snapshots) {
+      RemoveFile(options_.dir + "/" + SnapshotName(existing), reclaimed);
+    }
+    for (std::uint64_t segment : WriteAheadLog::ListSegments(options_.dir)) {
+      if (segment >= covered.segment) {
+        break;
+      }
+      RemoveFile(WriteAheadLog::SegmentPath(options_.dir, segment), reclaimed);
+    }
+  }
+
+  struct stat st;
+  std::uint64_t snapshot_bytes = 0;
+  if (::stat((options_.dir + "/" + name).c_str(), &st) == 0) {
+    snapshot_bytes = static_cast<std::uint64_t>(st.st_size);
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - started);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.runs += 1;
+    stats_.snapshot_bytes = snapshot_bytes;
+    stats_.bytes_reclaimed = reclaimed;
+    stats_.duration = elapsed;
+    stats_.total_bytes_reclaimed += reclaimed;
+    compacted_log_bytes_ = log_bytes;
+  }
+  Log(LogLevel::kInfo, "Compaction wrote {} ({} bytes), reclaimed {} bytes in {} ms", name,
+      snapshot_bytes, reclaimed, elapsed.count());
+  return true;
+}
+
+bool Compactor::writeManifest(const std::string& snapshot_name, std::string* error) {
+  std::string path = options_.dir + "/" + kManifestName;
+  std::string tmp_path = path + ".tmp";
+  std::string contents = "snapshot " + snapshot_name + "\n";
+  int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    *error = "open " + tmp_path + ": " + std::strerror(errno);
+    return false;
+  }
+  bool ok = ::write(fd, contents.data(), contents.size()) ==
+                static_cast<ssize_t>(contents.size()) &&
+            ::fdatasync(fd) == 0;
+  ::close(fd);
+  if (!ok || ::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    *error = "write " + path + ": " + std::strerror(errno);
+    ::unlink(tmp_path.c_str());
+    return false;
+  }
+  int dir_fd = ::open(options_.dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+  return true;
+}
+
+bool Compactor::ReadManifest(const std::string& dir, std::string* snapshot_path,
+                             std::string* error) {
+  snapshot_path->clear();
+  std::string path = dir + "/" + kManifestName;
+  FILE* file = std::fopen(path.c_str(), "r");
+  if (file == nullptr) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    *error = "open " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  char name[256];
+  bool ok = std::fscanf(file, "snapshot %255s", name) == 1;
+  std::fclose(file);
+  if (!ok) {
+    *error = path + " is malformed";
+    return false;
+  }
+  *snapshot_path = dir + "/" + name;
+  return true;
+}
@@ -0,0 +1,76 @@
+#ifndef COMPACTOR_H
+#define COMPACTOR_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "auction_service.h"
+#include "wal.h"
+
+struct CompactionOptions {
+  std::string dir;
+  // Compact once this much log has been written since the last pass...
+  std::uint64_t log_bytes_trigger = 256u << 20;
+  // ...or this long after it if any log has been written. 0 disables.
+  std::chrono::seconds interval{300};
+  // Snapshot write rate, so compaction does not compete with the log for
+  // the disk; 0 is unlimited.
+  std::uint64_t max_bytes_per_second = 64u << 20;
+};
+
+struct CompactionStats {
+  std::uint64_t runs = 0;
+  std::uint64_t snapshot_bytes = 0;   // size of the latest snapshot
+  std::uint64_t bytes_reclaimed = 0;  // by the latest pass
+  std::chrono::milliseconds duration{0};  // of the latest pass
+  std::uint64_t total_bytes_reclaimed = 0;
+};
+
+// Keeps the data directory from growing without bound. Each pass folds the
+// log into a new snapshot-NNNNNN.bin, atomically points MANIFEST at it, then
+// deletes the older snapshots and every log segment the new one covers.
+// Recovery reads MANIFEST, loads that snapshot and replays the remaining
+// segments.
+class Compactor {
+public:
+  Compactor(AuctionService& service, WriteAheadLog& wal, CompactionOptions options);
+  ~Compactor();
+
+  Compactor(const Compactor&) = delete;
+  Compactor& operator=(const Compactor&) = delete;
+
+  // Runs passes on a background thread as the triggers fire.
+  void Start();
+  void Stop();
+
+  // Runs one pass now.
+  bool CompactNow(std::string* error);
+
+  CompactionStats stats() const;
+
+  // Sets `snapshot_path` to the snapshot MANIFEST names, or empty if there
+  // is no manifest yet.
+  static bool ReadManifest(const std::string& dir, std::string* snapshot_path,
+                           std::string* error);
+
+private:
+  void run();
+  bool writeManifest(const std::string& snapshot_name, std::string* error);
+
+  AuctionService& service_;
+  WriteAheadLog& wal_;
+  const CompactionOptions options_;
+
+  std::mutex pass_mutex_;  // one pass at a time
+  mutable std::mutex mutex_;
+  std::condition_variable stop_cond_;
+  bool stopping_ = false;
+  CompactionStats stats_;
+  std::uint64_t compacted_log_bytes_ = 0;  // WriteAheadLog::Stats::bytes at the last pass
+  std::thread thread_;
+};
+
+#endif // COMPACTOR_H
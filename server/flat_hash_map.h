@@ -0,0 +1,252 @@
+#ifndef FLAT_HASH_MAP_H
+#define FLAT_HASH_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// 64x64 -> 128 bit multiply folded back to 64 bits. One round mixes every
+// input bit into the high and low halves.
+inline std::uint64_t HashMix(std::uint64_t value, std::uint64_t multiplier) {
+  unsigned __int128 product = static_cast<unsigned __int128>(value) * multiplier;
+  return static_cast<std::uint64_t>(product >> 64) ^ static_cast<std::uint64_t>(product);
+}
+
+// Reads eight bytes at a time, so short keys such as nicknames cost one or
+// two multiplies.
+inline std::uint64_t HashBytes(const void* data, std::size_t size) {
+  constexpr std::uint64_t kMultiplier = 0x9E3779B97F4A7C15ull;
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  std::uint64_t hash = HashMix(size ^ 0xA0761D6478BD642Full, kMultiplier);
+  while (size >= 8) {
+    std::uint64_t word;
+    std::memcpy(&word, bytes, 8);
+    hash = HashMix(hash ^ word, kMultiplier);
+    bytes += 8;
+    size -= 8;
+  }
+  if (size > 0) {
+    std::uint64_t word = 0;
+    std::memcpy(&word, bytes, size);
+    hash = HashMix(hash ^ word ^ 0xE7037ED1A0B428DBull, kMultiplier);
+  }
+  return hash;
+}
+
+template <typename Key, typename Enable = void>
+struct FlatHash;
+
+template <typename Key>
+struct FlatHash<Key, typename std::enable_if<std::is_integral<Key>::value>::type> {
+  std::uint64_t operator()(Key key) const {
+    return HashMix(static_cast<std::uint64_t>(key), 0x9E3779B97F4A7C15ull);
+  }
+};
+
+// std::string and std::string_view hash alike, so either can look up the other.
+struct FlatStringHash {
+  std::uint64_t operator()(std::string_view key) const {
+    return HashBytes(key.data(), key.size());
+  }
+};
+
+template <>
+struct FlatHash<std::string> : FlatStringHash {};
+template <>
+struct FlatHash<std::string_view> : FlatStringHash {};
+
+// An open-addressing hash map with linear probing. Entries sit inline in one
+// array beside a byte per slot holding 7 bits of the hash. A probe checks
+// eight of those bytes per step and only reads a slot whose byte matches, so
+// a lookup is usually one miss in each array and never allocates. Find() and
+// TryEmplace() take any key type that Hash accepts and compares equal to Key,
+// e.g. a string_view against std::string keys.
+//
+// Entries are never erased, which is all the server's tables need. Growing
+// moves every entry, so pointers returned by Find() are valid only until the
+// next insert; keep large or address-stable payloads elsewhere and store a
+// handle. Not thread-safe; the caller locks.
+template <typename Key, typename Value, typename Hash = FlatHash<Key>>
+class FlatHashMap {
+public:
+  FlatHashMap() = default;
+  FlatHashMap(const FlatHashMap&) = delete;
+  FlatHashMap& operator=(const FlatHashMap&) = delete;
+
+  template <typename K>
+  Value* Find(const K& key) {
+    return size_ != 0 ? find(key, Hash()(key)) : nullptr;
+  }
+
+  template <typename K>
+  const Value* Find(const K& key) const {
+    return const_cast<FlatHashMap*>(this)->Find(key);
+  }
+
+  // Inserts Key(key) -> Value(args...) unless the key is present. Returns the
+  // entry's value and whether it was inserted.
+  template <typename K, typename... Args>
+  std::pair<Value*, bool> TryEmplace(const K& key, Args&&... args) {
+    std::uint64_t hash = Hash()(key);
+    if (size_ != 0) {
+      if (Value* existing = find(key, hash)) {
+        return {existing, false};
+      }
+    }
+    if ((size_ + 1) * 8 > capacity() * 7) {
+      rehash(capacity() == 0 ? kMinCapacity : capacity() * 2);
+    }
+    std::size_t i = emptySlot(hash);
+    setTag(i, tagOf(hash));
+    slots_[i].key = Key(key);
+    slots_[i].value = Value(std::forward<Args>(args)...);
+    ++size_;
+    return {&slots_[i].value, true};
+  }
+
+  // Sizes the table so `count` entries fit without growing.
+  void Reserve(std::size_t count) {
+    std::size_t wanted = kMinCapacity;
+    while (count * 8 > wanted * 7) {
+      wanted *= 2;
+    }
+    if (wanted > capacity()) {
+      rehash(wanted);
+    }
+  }
+
+  // Calls fn(key, value) for every entry, in no particular order.
+  template <typename Fn>
+  void ForEach(Fn&& fn) {
+    for (std::size_t i = 0; i < capacity(); ++i) {
+      if (tags_[i] != kEmpty) {
+        fn(static_cast<const Key&>(slots_[i].key), slots_[i].value);
+      }
+    }
+  }
+
+  template <typename Fn>
+  void ForEach(Fn&& fn) const {
+    for (std::size_t i = 0; i < capacity(); ++i) {
+      if (tags_[i] != kEmpty) {
+        fn(slots_[i].key, static_cast<const Value&>(slots_[i].value));
+      }
+    }
+  }
+
+  std::size_t size() const { return size_; }
+  std::size_t capacity() const { return slots_ ? mask_ + 1 : 0; }
+
+  std::size_t MemoryBytes() const {
+    return capacity() == 0 ? 0 : capacity() * (sizeof(Slot) + 1) + kGroupSize;
+  }
+
+private:
+  struct Slot {
+    Key key;
+    Value value;
+  };
+
+  static constexpr std::size_t kMinCapacity = 16;
+  static constexpr std::uint8_t kEmpty = 0;
+  // Probes look at eight tags at once, as one word.
+  static constexpr std::size_t kGroupSize = 8;
+  static constexpr std::uint64_t kLowBytes = 0x0101010101010101ull;
+  static constexpr std::uint64_t kHighBits = 0x8080808080808080ull;
+
+  // The tag is the top 7 bits and the home slot the low bits; callers that
+  // stripe tables across shards pick the shard from the bits in between.
+  static std::uint8_t tagOf(std::uint64_t hash) {
+    return static_cast<std::uint8_t>(0x80 | (hash >> 57));
+  }
+
+  template <typename K>
+  Value* find(const K& key, std::uint64_t hash) {
+    // Most keys sit in their home slot; check it before scanning groups.
+    std::size_t home = hash & mask_;
+    if (tags_[home] == tagOf(hash) && slots_[home].key == key) {
+      return &slots_[home].value;
+    }
+    std::uint64_t tag_bytes = kLowBytes * tagOf(hash);
+    for (std::size_t group = home;; group = (group + kGroupSize) & mask_) {
+      std::uint64_t tags = loadGroup(group);
+      for (std::uint64_t match = matchTag(tags, tag_bytes); match != 0; match &= match - 1) {
+        std::size_t i = (group + lowestByte(match)) & mask_;
+        if (slots_[i].key == key) {
+          return &slots_[i].value;
+        }
+      }
+      if (matchEmpty(tags) != 0) {
+        return nullptr;
+      }
+    }
+  }
+
+  // Tags of the kGroupSize slots from `first`. The first kGroupSize tags are
+  // mirrored past the end so a group never wraps.
+  std::uint64_t loadGroup(std::size_t first) const {
+    std::uint64_t tags;
+    std::memcpy(&tags, &tags_[first], sizeof(tags));
+    return tags;
+  }
+
+  // High bit set in each byte of `tags` equal to the tag in `tag_bytes`. May
+  // also flag a byte just above a true match; the key compare rejects it.
+  static std::uint64_t matchTag(std::uint64_t tags, std::uint64_t tag_bytes) {
+    std::uint64_t diff = tags ^ tag_bytes;
+    return (diff - kLowBytes) & ~diff & kHighBits;
+  }
+
+  // Every used tag has its high bit set, so a clear one is empty.
+  static std::uint64_t matchEmpty(std::uint64_t tags) { return ~tags & kHighBits; }
+
+  static std::size_t lowestByte(std::uint64_t match) {
+    return static_cast<std::size_t>(__builtin_ctzll(match)) / 8;
+  }
+
+  std::size_t emptySlot(std::uint64_t hash) const {
+    for (std::size_t group = hash & mask_;; group = (group + kGroupSize) & mask_) {
+      std::uint64_t empty = matchEmpty(loadGroup(group));
+      if (empty != 0) {
+        return (group + lowestByte(empty)) & mask_;
+      }
+    }
+  }
+
+  void setTag(std::size_t i, std::uint8_t tag) {
+    tags_[i] = tag;
+    if (i < kGroupSize) {
+      tags_[capacity() + i] = tag;
+    }
+  }
+
+  void rehash(std::size_t new_capacity) {
+    std::unique_ptr<std::uint8_t[]> old_tags = std::move(tags_);
+    std::unique_ptr<Slot[]> old_slots = std::move(slots_);
+    std::size_t old_capacity = old_slots ? mask_ + 1 : 0;
+
+    tags_.reset(new std::uint8_t[new_capacity + kGroupSize]());
+    slots_.reset(new Slot[new_capacity]);  // tags mark the slots in use
+    mask_ = new_capacity - 1;
+    for (std::size_t i = 0; i < old_capacity; ++i) {
+      if (old_tags[i] == kEmpty) {
+        continue;
+      }
+      std::size_t j = emptySlot(Hash()(old_slots[i].key));
+      setTag(j, old_tags[i]);
+      slots_[j] = std::move(old_slots[i]);
+    }
+  }
+
+  std::unique_ptr<std::uint8_t[]> tags_;
+  std::unique_ptr<Slot[]> slots_;
+  std::size_t mask_ = 0;
+  std::size_t size_ = 0;
+};
+
+#endif // FLAT_HASH_MAP_H
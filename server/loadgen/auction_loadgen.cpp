@@ -0,0 +1,711 @@
+// Load generator for the Auction service. Worker threads share a few
+// channels and call RegisterUser, AddProduct, GetProducts and PlaceBid in a
+// weighted mix, bidding on products picked by Zipfian popularity.
+//
+// Closed loop (the default), each thread issues its next call as soon as the
+// last one returns. Open loop (--rate=N), calls are scheduled as a Poisson
+// process at N per second in total, and each call's latency is measured from
+// when it was scheduled rather than when it was sent, so a stalled server is
+// charged for the calls that queued up behind the stall (coordinated
+// omission).
+//
+// Before the run, --users users and --products products are created; bids go
+// to those products only.
+//
+// With --bid-stream, each worker sends its bids on one BidStream call
+// instead of a PlaceBid call each, waiting for each result before the next.
+//
+// With --batch=N, the add and bid operations each send N products or bids in
+// one AddProducts or PlaceBids call; calls/s then counts calls, not items.
+//
+// With --watchers=N, N WatchProducts streams stay open for the run, and each
+// bid they are sent is timed from when it was placed, which its amount
+// encodes, to when it arrived.
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+#include "e-space.grpc.pb.h"
+#include "rpc_stats.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum Op { kRegisterUser, kAddProduct, kGetProducts, kPlaceBid, kOpCount };
+
+const char* const kOpNames[kOpCount] = {"RegisterUser", "AddProduct", "GetProducts",
+                                        "PlaceBid"};
+const char* const kBatchOpNames[kOpCount] = {"RegisterUser", "AddProducts", "GetProducts",
+                                             "PlaceBids"};
+const char* const kMixKeys[kOpCount] = {"register", "add", "get", "bid"};
+
+struct LoadOptions {
+  std::string target = "localhost:50051";
+  int threads = 16;
+  int channels = 4;
+  double duration_s = 10;
+  double rate = 0;  // calls per second over all threads; 0 is closed loop
+  int users = 1000;
+  int products = 1000;
+  double zipf = 0.99;  // product popularity skew; 0 is uniform
+  int mix[kOpCount] = {1, 1, 2, 96};
+  int timeout_ms = 5000;
+  int watchers = 0;
+  int batch = 1;  // products or bids per add or bid call
+  bool bid_stream = false;
+  std::uint64_t seed = 1;
+  std::string json;  // also write the results as JSON here; "-" is stdout
+};
+
+// Parses "register:1,add:1,get:2,bid:96"; operations left out get weight 0.
+bool ParseMix(const char* text, int (&mix)[kOpCount]) {
+  std::fill(mix, mix + kOpCount, 0);
+  int total = 0;
+  while (*text != '\0') {
+    const char* colon = std::strchr(text, ':');
+    if (colon == nullptr) {
+      return false;
+    }
+    std::string key(text, colon);
+    int op = 0;
+    while (op < kOpCount && key != kMixKeys[op]) {
+      ++op;
+    }
+    char* end;
+    long weight = std::strtol(colon + 1, &end, 10);
+    if (op == kOpCount || weight < 0 || end == colon + 1 || (*end != ',' && *end != '\0')) {
+      return false;
+    }
+    mix[op] = static_cast<int>(weight);
+    total += mix[op];
+    text = *end == ',' ? end + 1 : end;
+  }
+  return total > 0;
+}
+
+bool ParseOptions(int argc, char** argv, LoadOptions& options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (std::strncmp(arg, "--target=", 9) == 0) {
+      options.target = arg + 9;
+    } else if (std::strncmp(arg, "--threads=", 10) == 0) {
+      options.threads = std::max(1, std::atoi(arg + 10));
+    } else if (std::strncmp(arg, "--channels=", 11) == 0) {
+      options.channels = std::max(1, std::atoi(arg + 11));
+    } else if (std::strncmp(arg, "--duration-s=", 13) == 0) {
+      options.duration_s = std::atof(arg + 13);
+    } else if (std::strncmp(arg, "--rate=", 7) == 0) {
+      options.rate = std::atof(arg + 7);
+    } else if (std::strncmp(arg, "--users=", 8) == 0) {
+      options.users = std::max(1, std::atoi(arg + 8));
+    } else if (std::strncmp(arg, "--products=", 11) == 0) {
+      options.products = std::max(1, std::atoi(arg + 11));
+    } else if (std::strncmp(arg, "--zipf=", 7) == 0) {
+      options.zipf = std::atof(arg + 7);
+    } else if (std::strncmp(arg, "--mix=", 6) == 0) {
+      if (!ParseMix(arg + 6, options.mix)) {
+        std::cerr << "Bad --mix, expected e.g. register:1,add:1,get:2,bid:96" << std::endl;
+        return false;
+      }
+    } else if (std::strncmp(arg, "--timeout-ms=", 13) == 0) {
+      options.timeout_ms = std::atoi(arg + 13);
+    } else if (std::strcmp(arg, "--bid-stream") == 0) {
+      options.bid_stream = true;
+    } else if (std::strncmp(arg, "--batch=", 8) == 0) {
+      options.batch = std::max(1, std::atoi(arg + 8));
+    } else if (std::strncmp(arg, "--watchers=", 11) == 0) {
+      options.watchers = std::max(0, std::atoi(arg + 11));
+    } else if (std::strncmp(arg, "--seed=", 7) == 0) {
+      options.seed = std::strtoull(arg + 7, nullptr, 10);
+    } else if (std::strncmp(arg, "--json=", 7) == 0) {
+      options.json = arg + 7;
+    } else {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      std::cerr << "Usage: auction_loadgen [--target=host:port] [--threads=N] [--channels=N]"
+                << " [--duration-s=S] [--rate=N] [--users=N] [--products=N] [--zipf=THETA]"
+                << " [--mix=register:W,add:W,get:W,bid:W] [--timeout-ms=N] [--bid-stream]"
+                << " [--batch=N] [--watchers=N] [--seed=N]"
+                << " [--json=PATH|-]" << std::endl;
+      return false;
+    }
+  }
+  if (options.zipf < 0 || options.zipf >= 1) {
+    std::cerr << "--zipf must be in [0, 1)" << std::endl;
+    return false;
+  }
+  if (options.batch > 1 && options.bid_stream) {
+    std::cerr << "--batch and --bid-stream do not mix" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Draws ranks in [0, n), rank k with probability proportional to
+// 1 / (k + 1)^theta, by the method of Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases", as YCSB does. Construction is O(n).
+class ZipfGenerator {
+public:
+  ZipfGenerator(std::uint64_t n, double theta) : n_(n), theta_(theta) {
+    for (std::uint64_t i = 1; i <= n; ++i) {
+      zeta_n_ += 1.0 / std::pow(static_cast<double>(i), theta);
+    }
+    double zeta_2 = 1.0 + 1.0 / std::pow(2.0, theta);
+    alpha_ = 1.0 / (1.0 - theta);
+    eta_ = (1.0 - std::pow(2.0 / static_cast<double>(n), 1.0 - theta)) /
+           (1.0 - zeta_2 / zeta_n_);
+  }
+
+  std::uint64_t Next(std::mt19937_64& rng) const {
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    if (theta_ == 0 || n_ < 3) {
+      return std::min(n_ - 1, static_cast<std::uint64_t>(u * static_cast<double>(n_)));
+    }
+    double uz = u * zeta_n_;
+    if (uz < 1.0) {
+      return 0;
+    }
+    if (uz < 1.0 + std::pow(0.5, theta_)) {
+      return 1;
+    }
+    auto rank = static_cast<std::uint64_t>(static_cast<double>(n_) *
+                                           std::pow(eta_ * u - eta_ + 1.0, alpha_));
+    return std::min(rank, n_ - 1);
+  }
+
+private:
+  std::uint64_t n_;
+  double theta_;
+  double zeta_n_ = 0;
+  double alpha_ = 0;
+  double eta_ = 0;
+};
+
+// What one worker saw; only that worker writes it.
+struct WorkerResult {
+  LatencyHistogram latency[kOpCount];
+  std::uint64_t errors[kOpCount] = {};
+  std::uint64_t bids_accepted = 0;
+  std::uint64_t bids_rejected = 0;
+};
+
+// State shared by the workers, read-only during the run.
+struct Workload {
+  const LoadOptions* options;
+  std::vector<std::shared_ptr<grpc::Channel>> channels;
+  std::vector<std::string> users;
+  std::vector<std::uint64_t> products;
+  std::unique_ptr<ZipfGenerator> popularity;
+  Clock::time_point start;
+  Clock::time_point end;
+};
+
+class Worker {
+public:
+  Worker(const Workload& workload, int index, WorkerResult& result)
+      : workload_(workload),
+        options_(*workload.options),
+        index_(index),
+        result_(result),
+        stub_(server::Auction::NewStub(
+            workload.channels[index % workload.channels.size()])),
+        rng_(options_.seed * 1000003 + static_cast<std::uint64_t>(index)) {
+    for (int op = 0; op < kOpCount; ++op) {
+      mix_total_ += options_.mix[op];
+    }
+  }
+
+  void Run() {
+    if (options_.rate > 0) {
+      runOpenLoop();
+    } else {
+      runClosedLoop();
+    }
+    closeBidStream();
+  }
+
+private:
+  void runClosedLoop() {
+    while (true) {
+      Clock::time_point sent = Clock::now();
+      if (sent >= workload_.end) {
+        return;
+      }
+      Op op = pickOp();
+      call(op);
+      record(op, Clock::now() - sent);
+    }
+  }
+
+  // Each thread runs an equal share of the rate as its own Poisson process.
+  void runOpenLoop() {
+    std::exponential_distribution<double> gap(options_.rate / options_.threads);
+    Clock::time_point scheduled = workload_.start;
+    while (true) {
+      scheduled += std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(gap(rng_)));
+      if (scheduled >= workload_.end) {
+        return;
+      }
+      std::this_thread::sleep_until(scheduled);
+      Op op = pickOp();
+      call(op);
+      record(op, Clock::now() - scheduled);
+    }
+  }
+
+  Op pickOp() {
+    int pick = std::uniform_int_distribution<int>(0, mix_total_ - 1)(rng_);
+    int op = 0;
+    while (pick >= options_.mix[op]) {
+      pick -= options_.mix[op++];
+    }
+    return static_cast<Op>(op);
+  }
+
+  const std::string& randomUser() {
+    return workload_.users[std::uniform_int_distribution<std::size_t>(
+        0, workload_.users.size() - 1)(rng_)];
+  }
+
+  void call(Op op) {
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() +
+                         std::chrono::milliseconds(options_.timeout_ms));
+    grpc::Status status;
+    switch (op) {
+      case kRegisterUser: {
+        server::RegisterUserRequest request;
+        server::RegisterUserResponse response;
+        request.set_nickname("loadgen-" + std::to_string(options_.seed) + "-" +
+                             std::to_string(index_) + "-" + std::to_string(++sequence_));
+        status = stub_->RegisterUser(&context, request, &response);
+        break;
+      }
+      case kAddProduct: {
+        if (options_.batch > 1) {
+          server::AddProductsRequest request;
+          server::AddProductsResponse response;
+          for (int i = 0; i < options_.batch; ++i) {
+            server::AddProductRequest* product = request.add_products();
+            product->set_name("loadgen item " + std::to_string(++sequence_));
+            product->set_seller(randomUser());
+            product->set_initial_price_cents(1000);
+          }
+          status = stub_->AddProducts(&context, request, &response);
+          break;
+        }
+        server::AddProductRequest request;
+        server::AddProductResponse response;
+        request.set_name("loadgen item " + std::to_string(++sequence_));
+        request.set_seller(randomUser());
+        request.set_initial_price_cents(1000);
+        status = stub_->AddProduct(&context, request, &response);
+        break;
+      }
+      case kGetProducts: {
+        server::GetProductsRequest request;
+        server::GetProductsResponse response;
+        status = stub_->GetProducts(&context, request, &response);
+        break;
+      }
+      case kPlaceBid: {
+        if (options_.batch > 1) {
+          server::PlaceBidsRequest request;
+          server::PlaceBidsResponse response;
+          for (int i = 0; i < options_.batch; ++i) {
+            fillBid(request.add_bids());
+          }
+          status = stub_->PlaceBids(&context, request, &response);
+          for (const server::PlaceBidResponse& result : response.results()) {
+            ++(result.success() ? result_.bids_accepted : result_.bids_rejected);
+          }
+          break;
+        }
+        server::PlaceBidRequest request;
+        server::PlaceBidResponse response;
+        fillBid(&request);
+        if (options_.bid_stream) {
+          if (!streamBid(request, &response)) {
+            status = grpc::Status(grpc::StatusCode::UNAVAILABLE, "bid stream broken");
+          }
+        } else {
+          status = stub_->PlaceBid(&context, request, &response);
+        }
+        if (status.ok()) {
+          ++(response.success() ? result_.bids_accepted : result_.bids_rejected);
+        }
+        break;
+      }
+      case kOpCount:
+        break;
+    }
+    if (!status.ok()) {
+      ++result_.errors[op];
+    }
+  }
+
+  void fillBid(server::PlaceBidRequest* bid) {
+    bid->set_product_id(workload_.products[workload_.popularity->Next(rng_)]);
+    bid->set_bidder(randomUser());
+    // Rises with time, so most bids beat the last one on their product.
+    bid->set_amount_cents(2000 + std::chrono::duration_cast<std::chrono::microseconds>(
+                                     Clock::now() - workload_.start).count());
+  }
+
+  // Sends one bid on the worker's BidStream call, opening it first if need
+  // be, and waits for its result. A broken stream is reopened next time.
+  bool streamBid(const server::PlaceBidRequest& bid, server::PlaceBidResponse* response) {
+    if (bid_stream_ == nullptr) {
+      bid_stream_context_ = std::make_unique<grpc::ClientContext>();
+      bid_stream_context_->set_deadline(
+          std::chrono::system_clock::now() + (workload_.end - Clock::now()) +
+          std::chrono::milliseconds(options_.timeout_ms));
+      bid_stream_ = stub_->BidStream(bid_stream_context_.get());
+    }
+    server::BidStreamRequest request;
+    request.set_seq(++sequence_);
+    *request.mutable_bid() = bid;
+    server::BidStreamResponse results;
+    if (!bid_stream_->Write(request) || !bid_stream_->Read(&results) ||
+        results.results_size() != 1 || results.results(0).seq() != request.seq()) {
+      bid_stream_context_->TryCancel();
+      closeBidStream();
+      return false;
+    }
+    response->set_success(results.results(0).success());
+    return true;
+  }
+
+  void closeBidStream() {
+    if (bid_stream_ == nullptr) {
+      return;
+    }
+    bid_stream_->WritesDone();
+    bid_stream_->Finish();
+    bid_stream_.reset();
+  }
+
+  void record(Op op, Clock::duration latency) {
+    result_.latency[op].Record(static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()));
+  }
+
+  const Workload& workload_;
+  const LoadOptions& options_;
+  const int index_;
+  WorkerResult& result_;
+  std::unique_ptr<server::Auction::Stub> stub_;
+  std::unique_ptr<grpc::ClientContext> bid_stream_context_;
+  std::unique_ptr<grpc::ClientReaderWriter<server::BidStreamRequest, server::BidStreamResponse>>
+      bid_stream_;
+  std::mt19937_64 rng_;
+  int mix_total_ = 0;
+  std::uint64_t sequence_ = 0;
+};
+
+// What the watchers saw, shared by all of them.
+struct WatchResult {
+  std::mutex mutex;  // guards everything below
+  LatencyHistogram lag;  // bid placed to bid received
+  std::uint64_t messages = 0;
+  std::uint64_t updates = 0;
+  std::uint64_t failed = 0;  // streams that ended before the run did
+};
+
+// One WatchProducts stream, open until Cancel().
+class Watcher final : public grpc::ClientReadReactor<server::ProductUpdates> {
+public:
+  Watcher(server::Auction::Stub& stub, const Workload& workload, WatchResult& result)
+      : workload_(workload), result_(result) {
+    stub.async()->WatchProducts(&context_, &request_, this);
+    StartRead(&updates_);
+    StartCall();
+  }
+
+  void Cancel() { context_.TryCancel(); }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [&] { return done_; });
+  }
+
+  void OnReadDone(bool ok) override {
+    if (!ok) {
+      return;
+    }
+    Clock::time_point now = Clock::now();
+    {
+      std::lock_guard<std::mutex> lock(result_.mutex);
+      ++result_.messages;
+      result_.updates += static_cast<std::uint64_t>(updates_.products_size());
+      for (const server::ProductInfo& product : updates_.products()) {
+        // Bid amounts are 2000 plus the microseconds into the run they
+        // were sent at; initial prices are below that.
+        std::int64_t placed_us = product.current_price_cents() - 2000;
+        Clock::time_point placed = workload_.start + std::chrono::microseconds(placed_us);
+        if (placed_us >= 0 && placed <= now) {
+          result_.lag.Record(static_cast<std::uint64_t>(
+              std::chrono::duration_cast<std::chrono::nanoseconds>(now - placed).count()));
+        }
+      }
+    }
+    StartRead(&updates_);
+  }
+
+  void OnDone(const grpc::Status& status) override {
+    if (status.error_code() != grpc::StatusCode::CANCELLED) {
+      std::lock_guard<std::mutex> lock(result_.mutex);
+      ++result_.failed;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+    done_cond_.notify_one();
+  }
+
+private:
+  const Workload& workload_;
+  WatchResult& result_;
+  grpc::ClientContext context_;
+  server::WatchProductsRequest request_;
+  server::ProductUpdates updates_;
+  std::mutex mutex_;
+  std::condition_variable done_cond_;
+  bool done_ = false;
+};
+
+// Creates the users and products the run bids with, spread over the
+// channels; products go kPopulateBatch to a call.
+constexpr int kPopulateBatch = 1000;
+
+bool Populate(Workload& workload) {
+  const LoadOptions& options = *workload.options;
+  for (int i = 0; i < options.users; ++i) {
+    workload.users.push_back("loadgen-" + std::to_string(options.seed) + "-user-" +
+                             std::to_string(i));
+  }
+  workload.products.resize(static_cast<std::size_t>(options.products));
+  std::atomic<bool> failed{false};
+  std::vector<std::thread> threads;
+  int thread_count = std::min<int>(options.threads, 16);
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t] {
+      auto stub = server::Auction::NewStub(
+          workload.channels[static_cast<std::size_t>(t) % workload.channels.size()]);
+      for (int i = t; i < options.users && !failed; i += thread_count) {
+        grpc::ClientContext context;
+        server::RegisterUserRequest request;
+        server::RegisterUserResponse response;
+        request.set_nickname(workload.users[i]);
+        failed = failed || !stub->RegisterUser(&context, request, &response).ok();
+      }
+      for (int first = t * kPopulateBatch; first < options.products && !failed;
+           first += thread_count * kPopulateBatch) {
+        int last = std::min(options.products, first + kPopulateBatch);
+        grpc::ClientContext context;
+        server::AddProductsRequest request;
+        server::AddProductsResponse response;
+        for (int i = first; i < last; ++i) {
+          server::AddProductRequest* product = request.add_products();
+          product->set_name("loadgen product " + std::to_string(i));
+          product->set_seller(workload.users[i % workload.users.size()]);
+          product->set_initial_price_cents(1000);
+        }
+        grpc::Status status = stub->AddProducts(&context, request, &response);
+        if (!status.ok() || response.results_size() != last - first) {
+          failed = true;
+          break;
+        }
+        for (int i = first; i < last; ++i) {
+          const server::AddProductResponse& result = response.results(i - first);
+          failed = failed || !result.success();
+          workload.products[i] = result.product_id();
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  return !failed;
+}
+
+struct MethodSummary {
+  const char* name;
+  LatencyCounts latency;
+  std::uint64_t errors = 0;
+  double per_second = 0;
+};
+
+void PrintText(const LoadOptions& options, double elapsed_s,
+               const std::vector<MethodSummary>& methods, std::uint64_t accepted,
+               std::uint64_t rejected, const WatchResult& watch) {
+  std::printf("%s: %d threads, %d channels, %.1f s, ", options.target.c_str(),
+              options.threads, options.channels, elapsed_s);
+  if (options.rate > 0) {
+    std::printf("open loop at %.0f calls/s (latency from scheduled start)\n", options.rate);
+  } else {
+    std::printf("closed loop\n");
+  }
+  if (options.batch > 1) {
+    std::printf("%d products or bids per add or bid call\n", options.batch);
+  }
+  std::printf("%-14s %10s %8s %11s %10s %10s %10s %10s\n", "method", "calls", "errors",
+              "calls/s", "p50 us", "p99 us", "p99.9 us", "max us");
+  for (const MethodSummary& method : methods) {
+    std::printf("%-14s %10" PRIu64 " %8" PRIu64 " %11.1f %10.1f %10.1f %10.1f %10.1f\n",
+                method.name, method.latency.count(), method.errors, method.per_second,
+                method.latency.Percentile(0.5) / 1e3, method.latency.Percentile(0.99) / 1e3,
+                method.latency.Percentile(0.999) / 1e3, method.latency.max() / 1e3);
+  }
+  std::printf("bids accepted %" PRIu64 ", rejected %" PRIu64 "\n", accepted, rejected);
+  if (options.watchers > 0) {
+    LatencyCounts lag;
+    lag.Add(watch.lag);
+    std::printf("watchers %d (%" PRIu64 " failed): %" PRIu64 " messages, %" PRIu64
+                " updates; bid to watcher p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+                options.watchers, watch.failed, watch.messages, watch.updates,
+                lag.Percentile(0.5) / 1e6, lag.Percentile(0.99) / 1e6, lag.max() / 1e6);
+  }
+}
+
+bool WriteJson(const LoadOptions& options, double elapsed_s,
+               const std::vector<MethodSummary>& methods, std::uint64_t accepted,
+               std::uint64_t rejected, const WatchResult& watch) {
+  std::FILE* out = options.json == "-" ? stdout : std::fopen(options.json.c_str(), "w");
+  if (out == nullptr) {
+    std::cerr << "Cannot write " << options.json << ": " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  std::fprintf(out,
+               "{\"target\":\"%s\",\"threads\":%d,\"channels\":%d,\"duration_s\":%.3f,"
+               "\"rate\":%.1f,\"zipf\":%.3f,\"batch\":%d,\"bids_accepted\":%" PRIu64
+               ",\"bids_rejected\":%" PRIu64 ",\"methods\":{",
+               options.target.c_str(), options.threads, options.channels, elapsed_s,
+               options.rate, options.zipf, options.batch, accepted, rejected);
+  for (std::size_t i = 0; i < methods.size(); ++i) {
+    const MethodSummary& method = methods[i];
+    std::fprintf(out,
+                 "%s\"%s\":{\"calls\":%" PRIu64 ",\"errors\":%" PRIu64
+                 ",\"calls_per_s\":%.1f,\"mean_ns\":%" PRIu64 ",\"p50_ns\":%" PRIu64
+                 ",\"p99_ns\":%" PRIu64 ",\"p999_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64 "}",
+                 i == 0 ? "" : ",", method.name, method.latency.count(), method.errors,
+                 method.per_second, method.latency.Mean(), method.latency.Percentile(0.5),
+                 method.latency.Percentile(0.99), method.latency.Percentile(0.999),
+                 method.latency.max());
+  }
+  std::fprintf(out, "}");
+  if (options.watchers > 0) {
+    LatencyCounts lag;
+    lag.Add(watch.lag);
+    std::fprintf(out,
+                 ",\"watch\":{\"watchers\":%d,\"failed\":%" PRIu64 ",\"messages\":%" PRIu64
+                 ",\"updates\":%" PRIu64 ",\"lag_p50_ns\":%" PRIu64 ",\"lag_p99_ns\":%" PRIu64
+                 ",\"lag_max_ns\":%" PRIu64 "}",
+                 options.watchers, watch.failed, watch.messages, watch.updates,
+                 lag.Percentile(0.5), lag.Percentile(0.99), lag.max());
+  }
+  std::fprintf(out, "}\n");
+  return out == stdout || std::fclose(out) == 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  LoadOptions options;
+  if (!ParseOptions(argc, argv, options)) {
+    return 1;
+  }
+
+  Workload workload;
+  workload.options = &options;
+  for (int i = 0; i < options.channels; ++i) {
+    // Without this, channels to one target share a connection.
+    grpc::ChannelArguments args;
+    args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    workload.channels.push_back(
+        grpc::CreateCustomChannel(options.target, grpc::InsecureChannelCredentials(), args));
+  }
+  if (!Populate(workload)) {
+    std::cerr << "Cannot create users and products on " << options.target << std::endl;
+    return 1;
+  }
+  workload.popularity = std::make_unique<ZipfGenerator>(workload.products.size(), options.zipf);
+
+  WatchResult watch;
+  std::vector<std::unique_ptr<server::Auction::Stub>> watch_stubs;
+  for (const std::shared_ptr<grpc::Channel>& channel : workload.channels) {
+    watch_stubs.push_back(server::Auction::NewStub(channel));
+  }
+  std::vector<std::unique_ptr<WorkerResult>> results;
+  std::vector<std::thread> threads;
+  workload.start = Clock::now();
+  std::vector<std::unique_ptr<Watcher>> watchers;
+  for (int i = 0; i < options.watchers; ++i) {
+    watchers.push_back(std::make_unique<Watcher>(
+        *watch_stubs[static_cast<std::size_t>(i) % watch_stubs.size()], workload, watch));
+  }
+  workload.end = workload.start + std::chrono::duration_cast<Clock::duration>(
+                                      std::chrono::duration<double>(options.duration_s));
+  for (int i = 0; i < options.threads; ++i) {
+    results.push_back(std::make_unique<WorkerResult>());
+    threads.emplace_back([&workload, i, &result = *results.back()] {
+      Worker(workload, i, result).Run();
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  double elapsed_s = std::chrono::duration<double>(Clock::now() - workload.start).count();
+  // Leaves time for the last bids to reach the watchers.
+  if (!watchers.empty()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  }
+  for (const std::unique_ptr<Watcher>& watcher : watchers) {
+    watcher->Cancel();
+  }
+  for (const std::unique_ptr<Watcher>& watcher : watchers) {
+    watcher->Wait();
+  }
+
+  std::vector<MethodSummary> methods;
+  std::uint64_t accepted = 0;
+  std::uint64_t rejected = 0;
+  for (int op = 0; op < kOpCount; ++op) {
+    MethodSummary method;
+    method.name = options.batch > 1 ? kBatchOpNames[op] : kOpNames[op];
+    for (const std::unique_ptr<WorkerResult>& result : results) {
+      method.latency.Add(result->latency[op]);
+      method.errors += result->errors[op];
+    }
+    method.per_second = static_cast<double>(method.latency.count()) / elapsed_s;
+    if (options.mix[op] != 0) {
+      methods.push_back(method);
+    }
+  }
+  for (const std::unique_ptr<WorkerResult>& result : results) {
+    accepted += result->bids_accepted;
+    rejected += result->bids_rejected;
+  }
+
+  PrintText(options, elapsed_s, methods, accepted, rejected, watch);
+  if (!options.json.empty() &&
+      !WriteJson(options, elapsed_s, methods, accepted, rejected, watch)) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,309 @@
+#include "logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+std::atomic<LogLevel> Logger::level_{LogLevel::kOff};
+std::atomic<int> Logger::sample_every_{1};
+
+namespace {
+
+// State shared by the logging threads and the formatter.
+struct LogState {
+  std::mutex mutex;  // guards everything below; held while collecting records
+  std::condition_variable stop_cond;
+  LoggerOptions options;
+  std::vector<std::shared_ptr<LogRing>> rings;
+  std::uint64_t dropped = 0;  // total across rings, including freed ones
+  bool stopping = false;
+  std::thread formatter;
+};
+
+// Never destroyed, so threads that outlive main() can still log into their
+// rings and close them.
+LogState& State() {
+  static LogState* state = new LogState();
+  return *state;
+}
+
+// Owns the thread's reference to its ring and closes it at thread exit.
+struct ThreadRingHolder {
+  std::shared_ptr<LogRing> ring;
+  ~ThreadRingHolder() {
+    if (ring != nullptr) {
+      ring->Close();
+    }
+  }
+};
+
+thread_local ThreadRingHolder t_ring;
+
+const char* LevelName(LogLevel level) {
+  switch (level) {
+    case LogLevel::kDebug:
+      return "DEBUG";
+    case LogLevel::kInfo:
+      return "INFO";
+    case LogLevel::kWarning:
+      return "WARN";
+    case LogLevel::kError:
+      return "ERROR";
+    case LogLevel::kOff:
+      break;
+  }
+  return "?";
+}
+
+// Turns records into "[LOG] 2024-05-01T12:00:00.000123Z INFO text" lines.
+class LineFormatter {
+public:
+  void Append(const LogRecord& record, std::string& out) {
+    out += "[LOG] ";
+    appendTime(record.time_ns, out);
+    out += ' ';
+    out += LevelName(record.level);
+    out += ' ';
+    int arg = 0;
+    for (const char* p = record.format; *p != '\0'; ++p) {
+      if (p[0] == '{' && p[1] == '}' && arg < record.arg_count) {
+        appendArg(record, record.args[arg++], out);
+        ++p;
+      } else {
+        out += *p;
+      }
+    }
+    out += '\n';
+  }
+
+private:
+  void appendTime(std::int64_t time_ns, std::string& out) {
+    std::int64_t seconds = time_ns / 1000000000;
+    if (seconds != cached_second_) {
+      std::time_t time = static_cast<std::time_t>(seconds);
+      std::tm utc;
+      gmtime_r(&time, &utc);
+      std::strftime(cached_text_, sizeof(cached_text_), "%Y-%m-%dT%H:%M:%S", &utc);
+      cached_second_ = seconds;
+    }
+    char micros[16];
+    std::snprintf(micros, sizeof(micros), ".%06lldZ",
+                  static_cast<long long>(time_ns % 1000000000 / 1000));
+    out += cached_text_;
+    out += micros;
+  }
+
+  // Numbers are appended in place, so once `out` has grown, formatting does
+  // not allocate.
+  static void appendArg(const LogRecord& record, const LogRecord::Arg& arg, std::string& out) {
+    switch (arg.type) {
+      case LogRecord::ArgType::kSigned:
+        appendNumber(static_cast<std::int64_t>(arg.value), out);
+        break;
+      case LogRecord::ArgType::kUnsigned:
+        appendNumber(arg.value, out);
+        break;
+      case LogRecord::ArgType::kText:
+        out.append(record.text + arg.text_offset, arg.text_size);
+        break;
+      case LogRecord::ArgType::kCents: {
+        // As FormatCents().
+        Cents cents = static_cast<Cents>(arg.value);
+        Cents magnitude = std::llabs(cents);
+        Cents fraction = magnitude % 100;
+        if (cents < 0) {
+          out += '-';
+        }
+        appendNumber(magnitude / 100, out);
+        out += fraction < 10 ? ".0" : ".";
+        appendNumber(fraction, out);
+        break;
+      }
+      case LogRecord::ArgType::kProductId:
+        out += "PROD_";
+        appendNumber(arg.value, out);
+        break;
+    }
+  }
+
+  template <typename T>
+  static void appendNumber(T value, std::string& out) {
+    char digits[24];
+    out.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+  }
+
+  std::int64_t cached_second_ = -1;
+  char cached_text_[32] = {};  // cached_second_ as text
+};
+
+void WriteAll(int fd, const std::string& text) {
+  std::size_t written = 0;
+  while (written < text.size()) {
+    ssize_t n = ::write(fd, text.data() + written, text.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;  // nowhere to report it
+    }
+    written += static_cast<std::size_t>(n);
+  }
+}
+
+// Enough for a full pass of a few busy threads without growing.
+constexpr std::size_t kOutputReserve = 256 << 10;
+constexpr std::size_t kPendingReserve = 4096;
+constexpr std::size_t kRingsReserve = 256;
+
+// A record collected in the current pass. Threads log into separate rings,
+// so records are sorted by time before they are written.
+struct PendingRecord {
+  std::int64_t time_ns;
+  std::uint32_t ring;
+  std::uint64_t number;
+
+  bool operator<(const PendingRecord& other) const {
+    if (time_ns != other.time_ns) {
+      return time_ns < other.time_ns;
+    }
+    return ring != other.ring ? ring < other.ring : number < other.number;
+  }
+};
+
+void FormatterLoop() {
+  LogState& state = State();
+  LineFormatter formatter;
+  std::string out;
+  out.reserve(kOutputReserve);
+  std::vector<PendingRecord> pending;
+  pending.reserve(kPendingReserve);
+  std::vector<std::uint64_t> ends;  // per ring
+  ends.reserve(kRingsReserve);
+  std::vector<bool> closed;
+  closed.reserve(kRingsReserve);
+  std::uint64_t reported_dropped = 0;
+  std::unique_lock<std::mutex> lock(state.mutex);
+  while (true) {
+    bool stopping = state.stop_cond.wait_for(lock, state.options.poll_interval,
+                                             [&] { return state.stopping; });
+    std::size_t ring_count = state.rings.size();
+    ends.resize(ring_count);
+    closed.resize(ring_count);
+    pending.clear();
+    std::uint64_t dropped = state.dropped;
+    for (std::size_t i = 0; i < ring_count; ++i) {
+      const LogRing& ring = *state.rings[i];
+      // Read first: a ring closed by now has nothing more coming.
+      closed[i] = ring.closed();
+      std::uint64_t first;
+      ring.Published(&first, &ends[i]);
+      for (std::uint64_t number = first; number != ends[i]; ++number) {
+        pending.push_back({ring.At(number).time_ns, static_cast<std::uint32_t>(i), number});
+      }
+      dropped += ring.dropped();
+    }
+    std::sort(pending.begin(), pending.end());
+    for (const PendingRecord& record : pending) {
+      formatter.Append(state.rings[record.ring]->At(record.number), out);
+    }
+    // Backwards, so removing a ring does not move one not yet visited.
+    for (std::size_t i = ring_count; i-- > 0;) {
+      state.rings[i]->Release(ends[i]);
+      if (closed[i]) {
+        state.dropped += state.rings[i]->dropped();
+        state.rings[i] = std::move(state.rings.back());
+        state.rings.pop_back();
+      }
+    }
+
+    if (dropped != reported_dropped) {
+      LogRecord record;
+      record.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::system_clock::now().time_since_epoch()).count();
+      record.format = "Log fell behind, {} records dropped so far";
+      record.level = LogLevel::kWarning;
+      record.arg_count = 0;
+      record.text_size = 0;
+      record.Put(dropped);
+      formatter.Append(record, out);
+      reported_dropped = dropped;
+    }
+    int fd = state.options.fd;
+    if (!out.empty()) {
+      lock.unlock();
+      WriteAll(fd, out);
+      out.clear();
+      lock.lock();
+    }
+    if (stopping) {
+      break;
+    }
+  }
+}
+
+}  // namespace
+
+LogRing::LogRing(std::size_t records)
+    : mask_([records] {
+        std::size_t capacity = 2;
+        while (capacity < records) {
+          capacity *= 2;
+        }
+        return capacity - 1;
+      }()) {
+  records_.reset(new LogRecord[mask_ + 1]);
+}
+
+void Logger::Start(LoggerOptions options) {
+  Stop();
+  LogState& state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.options = options;
+  state.stopping = false;
+  state.formatter = std::thread(FormatterLoop);
+  sample_every_.store(std::max(1, options.sample_every), std::memory_order_relaxed);
+  level_.store(options.level, std::memory_order_relaxed);
+}
+
+void Logger::Stop() {
+  level_.store(LogLevel::kOff, std::memory_order_relaxed);
+  LogState& state = State();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (!state.formatter.joinable()) {
+      return;
+    }
+    state.stopping = true;
+  }
+  state.stop_cond.notify_all();
+  state.formatter.join();
+}
+
+LogRing& Logger::ThreadRing() {
+  if (t_ring.ring == nullptr) {
+    LogState& state = State();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    t_ring.ring = std::make_shared<LogRing>(state.options.ring_records);
+    state.rings.push_back(t_ring.ring);
+  }
+  return *t_ring.ring;
+}
+
+std::uint64_t Logger::Dropped() {
+  LogState& state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  std::uint64_t dropped = state.dropped;
+  for (const std::shared_ptr<LogRing>& ring : state.rings) {
+    dropped += ring->dropped();
+  }
+  return dropped;
+}
@@ -0,0 +1,194 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include "money.h"
+#include "product_id.h"
+
+enum class LogLevel : std::uint8_t {
+  kDebug,    // one line per request received
+  kInfo,     // outcomes of requests and background work
+  kWarning,  // a request could not be served as asked
+  kError,    // the server cannot do its job
+  kOff,
+};
+
+struct LoggerOptions {
+  LogLevel level = LogLevel::kInfo;
+  // Keeps one in N records below kWarning, counted per thread; 1 keeps all.
+  int sample_every = 1;
+  int fd = 1;
+  // Records a thread can have waiting before its new ones are dropped.
+  // Rounded up to a power of two.
+  std::size_t ring_records = 512;
+  // How often the formatter thread collects records, so also how late a
+  // line can reach `fd`.
+  std::chrono::milliseconds poll_interval{5};
+};
+
+// A log line as the logging thread leaves it: the format, with "{}" for each
+// argument, and the arguments still in binary. The format must outlive the
+// logger, i.e. be a literal. String arguments are copied into `text` and cut
+// short if they do not fit.
+struct LogRecord {
+  static constexpr int kMaxArgs = 6;
+  static constexpr std::size_t kTextBytes = 192;
+
+  enum class ArgType : std::uint8_t { kSigned, kUnsigned, kText, kCents, kProductId };
+
+  struct Arg {
+    ArgType type;
+    std::uint16_t text_offset;  // kText: where in `text`
+    std::uint16_t text_size;
+    std::uint64_t value;
+  };
+
+  std::int64_t time_ns;  // since the Unix epoch
+  const char* format;
+  LogLevel level;
+  std::uint8_t arg_count;
+  std::uint16_t text_size;
+  Arg args[kMaxArgs];
+  char text[kTextBytes];
+
+  void Put(std::string_view value) {
+    std::size_t size = std::min(value.size(), kTextBytes - text_size);
+    std::memcpy(text + text_size, value.data(), size);
+    args[arg_count++] = {ArgType::kText, text_size, static_cast<std::uint16_t>(size), 0};
+    text_size = static_cast<std::uint16_t>(text_size + size);
+  }
+  void Put(CentsText value) {
+    args[arg_count++] = {ArgType::kCents, 0, 0, static_cast<std::uint64_t>(value.cents)};
+  }
+  void Put(ProductIdText value) {
+    args[arg_count++] = {ArgType::kProductId, 0, 0, value.id};
+  }
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value>::type Put(T value) {
+    args[arg_count++] = {std::is_signed<T>::value ? ArgType::kSigned : ArgType::kUnsigned, 0,
+                         0, static_cast<std::uint64_t>(value)};
+  }
+};
+
+// Single-producer, single-consumer queue of records: one logging thread
+// fills it and the formatter thread drains it. Neither side ever waits.
+class LogRing {
+public:
+  explicit LogRing(std::size_t records);
+
+  LogRing(const LogRing&) = delete;
+  LogRing& operator=(const LogRing&) = delete;
+
+  // Producer: the next free record, or nullptr (and one more drop) if full.
+  LogRecord* Claim() {
+    std::uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) > mask_) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    return &records_[head & mask_];
+  }
+
+  // Producer: hands the claimed record to the consumer.
+  void Publish() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Producer: whether to keep a record when keeping one in `every`.
+  bool Sample(int every) { return every <= 1 || sampled_++ % every == 0; }
+
+  // Consumer: the records published and not yet released are numbered
+  // [*first, *last). They stay valid until Release().
+  void Published(std::uint64_t* first, std::uint64_t* last) const {
+    *first = tail_.load(std::memory_order_relaxed);
+    *last = head_.load(std::memory_order_acquire);
+  }
+  const LogRecord& At(std::uint64_t number) const { return records_[number & mask_]; }
+  // Consumer: frees the records numbered below `last` for reuse.
+  void Release(std::uint64_t last) { tail_.store(last, std::memory_order_release); }
+
+  std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  // Set when the owning thread exits; the consumer frees the ring once it
+  // has drained it.
+  void Close() { closed_.store(true, std::memory_order_release); }
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+private:
+  std::unique_ptr<LogRecord[]> records_;
+  const std::uint64_t mask_;
+  alignas(64) std::atomic<std::uint64_t> head_{0};  // written by the producer
+  std::uint64_t sampled_ = 0;                        // producer only
+  alignas(64) std::atomic<std::uint64_t> tail_{0};  // written by the consumer
+  std::atomic<std::uint64_t> dropped_{0};
+  std::atomic<bool> closed_{false};
+};
+
+// Process-wide logger. Log() copies its arguments into the calling thread's
+// ring and returns: it takes no lock shared with other threads, formats
+// nothing and makes no system call. A background thread collects what the
+// rings hold, sorts it by time, formats it and writes it out with one
+// write() per pass. When a ring is full the record is dropped, and the
+// formatter reports how many were.
+//
+// Nothing is logged before Start() or after Stop(). A thread's first record
+// allocates its ring.
+class Logger {
+public:
+  // Starts the formatter thread; a running one is stopped first.
+  static void Start(LoggerOptions options);
+  // Writes out what the rings hold and stops the formatter thread.
+  static void Stop();
+
+  static bool Enabled(LogLevel level) {
+    return level >= level_.load(std::memory_order_relaxed);
+  }
+  static int SampleEvery() { return sample_every_.load(std::memory_order_relaxed); }
+
+  // The calling thread's ring, created on first use.
+  static LogRing& ThreadRing();
+
+  // Records dropped so far because their thread's ring was full.
+  static std::uint64_t Dropped();
+
+private:
+  static std::atomic<LogLevel> level_;
+  static std::atomic<int> sample_every_;
+};
+
+// Log(LogLevel::kInfo, "Bid placed for product {} at {}", ProductIdText{id},
+//     CentsText{amount});
+// Arguments may be integers, strings, CentsText and ProductIdText.
+template <typename... Args>
+void Log(LogLevel level, const char* format, const Args&... args) {
+  static_assert(sizeof...(Args) <= LogRecord::kMaxArgs, "too many log arguments");
+  if (!Logger::Enabled(level)) {
+    return;
+  }
+  LogRing& ring = Logger::ThreadRing();
+  if (level < LogLevel::kWarning && !ring.Sample(Logger::SampleEvery())) {
+    return;
+  }
+  LogRecord* record = ring.Claim();
+  if (record == nullptr) {
+    return;
+  }
+  record->time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+  record->format = format;
+  record->level = level;
+  record->arg_count = 0;
+  record->text_size = 0;
+  (record->Put(args), ...);
+  ring.Publish();
+}
+
+#endif // LOGGER_H
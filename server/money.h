@@ -0,0 +1,49 @@
+#ifndef MONEY_H
+#define MONEY_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <ostream>
+#include <string>
+
+// Prices are integer minor units (cents) everywhere in the server, so bid
+// comparisons are exact and a price fits in a single atomic word.
+using Cents = std::int64_t;
+
+// Converts a legacy floating-point dollar amount, rounding to the nearest cent.
+inline Cents DollarsToCents(double dollars) {
+  return static_cast<Cents>(std::llround(dollars * 100.0));
+}
+
+inline double CentsToDollars(Cents cents) {
+  return static_cast<double>(cents) / 100.0;
+}
+
+// "1234" -> "12.34", for log lines.
+inline std::string FormatCents(Cents cents) {
+  std::string text = cents < 0 ? "-" : "";
+  Cents magnitude = std::llabs(cents);
+  Cents fraction = magnitude % 100;
+  text += std::to_string(magnitude / 100);
+  text += fraction < 10 ? ".0" : ".";
+  text += std::to_string(fraction);
+  return text;
+}
+
+// Streams like FormatCents() but without building a string:
+// std::cout << CentsText{amount}. Log() takes it as an argument too.
+struct CentsText {
+  Cents cents;
+};
+
+inline std::ostream& operator<<(std::ostream& out, CentsText value) {
+  Cents magnitude = std::llabs(value.cents);
+  Cents fraction = magnitude % 100;
+  if (value.cents < 0) {
+    out << '-';
+  }
+  return out << magnitude / 100 << (fraction < 10 ? ".0" : ".") << fraction;
+}
+
+#endif // MONEY_H
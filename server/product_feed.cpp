@@ -0,0 +1,389 @@
+#include "product_feed.h"
+#include <iterator>
+#include <limits>
+#include <grpc/slice.h>
+#include "auction_service.h"
+#include "logger.h"
+#include "tracer.h"
+
+using grpc::ByteBuffer;
+using grpc::CallbackServerContext;
+using grpc::ServerWriteReactor;
+
+namespace {
+
+// A watcher's frame before it has been sent anything, when it asked for the
+// changes since a version: the first thing it is sent is a catch-up.
+constexpr std::uint64_t kCatchUp = std::numeric_limits<std::uint64_t>::max();
+
+// Catch-ups built per frame before lagging watchers share the nearest one
+// from an earlier version, or from the start of the catalog.
+constexpr std::size_t kMaxCatchUps = 16;
+
+grpc::Slice Serialize(const server::ProductUpdates& message) {
+  grpc_slice slice = grpc_slice_malloc(message.ByteSizeLong());
+  message.SerializeWithCachedSizesToArray(GRPC_SLICE_START_PTR(slice));
+  return grpc::Slice(slice, grpc::Slice::STEAL_REF);
+}
+
+class RejectedWatch final : public ServerWriteReactor<ByteBuffer> {
+public:
+  explicit RejectedWatch(grpc::Status status) { Finish(std::move(status)); }
+  void OnDone() override { delete this; }
+};
+
+}  // namespace
+
+// One WatchProducts stream. It writes one message at a time, and asks the
+// feed for the next only once the last is written, so a slow reader holds
+// a reference to at most one frame. The feed is asked without mutex_ held,
+// since it takes its own lock and pumps watchers under neither.
+class ProductFeed::Watcher final : public ServerWriteReactor<ByteBuffer> {
+public:
+  Watcher(ProductFeed& feed, std::uint64_t frame, std::uint64_t version)
+      : feed_(feed), frame_(frame), version_(version) {}
+
+  // `self` keeps the reactor alive until gRPC is done with it.
+  void Start(std::shared_ptr<Watcher> self) {
+    self_ = std::move(self);
+    Pump();
+  }
+
+  // Starts the next write unless one is in flight.
+  void Pump() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (busy_ || finished_) {
+      // Whoever is busy asks the feed again before giving up.
+      pump_again_ = true;
+      return;
+    }
+    bool asked = false;
+    for (;;) {
+      if (stopping_) {
+        finished_ = true;
+        lock.unlock();
+        Finish(status_);
+        return;
+      }
+      if (pending_ != nullptr && next_message_ < pending_->messages.size()) {
+        // The buffer takes a reference to the frame's bytes; nothing is copied.
+        buffer_ = ByteBuffer(&pending_->messages[next_message_++], 1);
+        busy_ = true;
+        lock.unlock();
+        StartWrite(&buffer_);
+        return;
+      }
+      if (asked && !pump_again_) {
+        return;
+      }
+      asked = true;
+      pump_again_ = false;
+      busy_ = true;
+      std::uint64_t frame = frame_;
+      std::uint64_t version = version_;
+      lock.unlock();
+      std::shared_ptr<const FeedFrame> next;
+      feed_.next(this, &frame, &version, &next);
+      lock.lock();
+      busy_ = false;
+      frame_ = frame;
+      version_ = version;
+      pending_ = std::move(next);
+      next_message_ = 0;
+    }
+  }
+
+  // Finishes the stream once the write in flight, if any, is done.
+  void Stop(grpc::Status status) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    stopping_ = true;
+    status_ = std::move(status);
+    if (!busy_ && !finished_) {
+      finished_ = true;
+      lock.unlock();
+      Finish(status_);
+    }
+  }
+
+  void OnWriteDone(bool ok) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      busy_ = false;
+      buffer_.Clear();
+      if (!ok) {
+        stopping_ = true;
+        status_ = grpc::Status::CANCELLED;
+      }
+    }
+    Pump();
+  }
+
+  void OnCancel() override { Stop(grpc::Status::CANCELLED); }
+
+  void OnDone() override {
+    feed_.remove(this);
+    // The last reference may be this one; nothing may follow it.
+    std::shared_ptr<Watcher> self = std::move(self_);
+  }
+
+private:
+  ProductFeed& feed_;
+  std::mutex mutex_;  // guards everything below
+  bool busy_ = false;  // writing, or asking the feed for what to write
+  bool pump_again_ = false;
+  bool stopping_ = false;
+  bool finished_ = false;
+  grpc::Status status_;
+  std::uint64_t frame_;
+  std::uint64_t version_;
+  std::shared_ptr<const FeedFrame> pending_;
+  std::size_t next_message_ = 0;
+  ByteBuffer buffer_;
+  std::shared_ptr<Watcher> self_;
+};
+
+ProductFeed::ProductFeed(AuctionService& service, ProductFeedOptions options)
+    : service_(service), options_(std::move(options)) {}
+
+ProductFeed::~ProductFeed() {
+  Stop();
+}
+
+void ProductFeed::Start() {
+  thread_ = std::thread(&ProductFeed::run, this);
+  catch_up_thread_ = std::thread(&ProductFeed::runCatchUps, this);
+}
+
+void ProductFeed::Stop() {
+  std::vector<std::shared_ptr<Watcher>> watchers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    for (const auto& entry : watchers_) {
+      watchers.push_back(entry.second);
+    }
+  }
+  stop_cond_.notify_one();
+  catch_up_cond_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  if (catch_up_thread_.joinable()) {
+    catch_up_thread_.join();
+  }
+  for (const std::shared_ptr<Watcher>& watcher : watchers) {
+    watcher->Stop(grpc::Status::OK);
+  }
+}
+
+ServerWriteReactor<ByteBuffer>* ProductFeed::Watch(CallbackServerContext* context,
+                                                   const ByteBuffer* request) {
+  ByteBuffer request_bytes = *request;
+  server::WatchProductsRequest watch;
+  if (!grpc::SerializationTraits<server::WatchProductsRequest>::Deserialize(&request_bytes,
+                                                                           &watch)
+           .ok()) {
+    return Reject(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "malformed request"));
+  }
+
+  std::shared_ptr<Watcher> watcher;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return Reject(grpc::Status(grpc::StatusCode::UNAVAILABLE, "server shutting down"));
+    }
+    if (watchers_.size() >= options_.max_watchers) {
+      return Reject(grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "too many watchers"));
+    }
+    // Without a version to start from, the watcher joins at the latest
+    // frame and is sent the next one.
+    std::uint64_t frame = latest_ != nullptr ? latest_->seq : 0;
+    std::uint64_t version = service_.CatalogVersion();
+    if (watch.since_version() != 0) {
+      frame = kCatchUp;
+      version = watch.since_version();
+    }
+    watcher = std::make_shared<Watcher>(*this, frame, version);
+    watchers_.emplace(watcher.get(), watcher);
+  }
+  Log(LogLevel::kDebug, "Watcher connected from {}, since version {}", context->peer(),
+      watch.since_version());
+  Watcher* reactor = watcher.get();
+  reactor->Start(std::move(watcher));
+  return reactor;
+}
+
+ServerWriteReactor<ByteBuffer>* ProductFeed::Reject(grpc::Status status) {
+  return new RejectedWatch(std::move(status));
+}
+
+std::size_t ProductFeed::WatcherCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return watchers_.size();
+}
+
+void ProductFeed::run() {
+  Tracer::SetThreadName("watch feed");
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_cond_.wait_for(lock, options_.interval, [&] { return stopping_; })) {
+    lock.unlock();
+    publish();
+    lock.lock();
+  }
+}
+
+void ProductFeed::publish() {
+  // Read before taking the changes: every change up to it has been queued
+  // by now, so a watcher sent this frame has every change up to `version`.
+  std::uint64_t version = service_.CatalogVersion();
+  std::vector<std::uint32_t> changed;
+  service_.TakeChangedProducts(&changed);
+  if (changed.empty() || WatcherCount() == 0) {
+    return;
+  }
+
+  TraceRequest trace("watch_frame", Tracer::Enabled());
+  trace.Set("products", changed.size());
+  auto frame = std::make_shared<FeedFrame>();
+  frame->version = version;
+  server::ProductUpdates message;
+  for (std::size_t i = 0; i < changed.size(); ++i) {
+    service_.ListProduct(changed[i], message.add_products());
+    if (message.products_size() == static_cast<int>(kMaxPageSize) || i + 1 == changed.size()) {
+      if (i + 1 == changed.size()) {
+        message.set_catalog_version(version);
+      }
+      frame->messages.push_back(Serialize(message));
+      message.Clear();
+    }
+  }
+
+  std::vector<std::shared_ptr<Watcher>> watchers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frame->seq = (latest_ != nullptr ? latest_->seq : 0) + 1;
+    latest_ = std::move(frame);
+    // Built ones are out of date; queued ones are built from here on.
+    for (auto it = catch_ups_.begin(); it != catch_ups_.end();) {
+      it = it->second.frame != nullptr ? catch_ups_.erase(it) : std::next(it);
+    }
+    watchers.reserve(watchers_.size());
+    for (const auto& entry : watchers_) {
+      watchers.push_back(entry.second);
+    }
+  }
+  TraceSpan span("pump");
+  for (const std::shared_ptr<Watcher>& watcher : watchers) {
+    watcher->Pump();
+  }
+}
+
+void ProductFeed::next(Watcher* watcher, std::uint64_t* frame, std::uint64_t* version,
+                       std::shared_ptr<const FeedFrame>* out) {
+  out->reset();
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::uint64_t latest = latest_ != nullptr ? latest_->seq : 0;
+  if (*frame == latest) {
+    return;
+  }
+  std::shared_ptr<const FeedFrame> chosen = latest_;
+  if (latest_ == nullptr || *frame + 1 != latest) {
+    // Missed a frame, or asked for the changes since a version: send each
+    // product changed since the version it has, as it is now. A catch-up
+    // from an earlier version holds every product this one would.
+    std::uint64_t since = *version;
+    auto it = catch_ups_.find(since);
+    if (it == catch_ups_.end() && catch_ups_.size() >= kMaxCatchUps) {
+      it = catch_ups_.upper_bound(since);
+      since = it != catch_ups_.begin() ? std::prev(it)->first : 0;
+      it = catch_ups_.find(since);
+    }
+    if (it == catch_ups_.end()) {
+      it = catch_ups_.emplace(since, CatchUp()).first;
+      queued_catch_ups_.push_back(since);
+      catch_up_cond_.notify_one();
+    }
+    if (it->second.frame == nullptr) {
+      it->second.waiting.insert(watcher);
+      return;
+    }
+    chosen = it->second.frame;
+  }
+  // A catch-up built before the latest frame leaves the watcher to be sent
+  // that frame next; the catch-up has every change from before it.
+  *frame = chosen->seq;
+  *version = chosen->version;
+  if (!chosen->messages.empty()) {
+    *out = std::move(chosen);
+  }
+}
+
+void ProductFeed::runCatchUps() {
+  Tracer::SetThreadName("watch catch-up");
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    catch_up_cond_.wait(lock, [&] { return stopping_ || !queued_catch_ups_.empty(); });
+    if (stopping_) {
+      return;
+    }
+    std::uint64_t since = queued_catch_ups_.front();
+    queued_catch_ups_.pop_front();
+    std::uint64_t seq = latest_ != nullptr ? latest_->seq : 0;
+    lock.unlock();
+    std::shared_ptr<const FeedFrame> frame = buildCatchUp(since, seq);
+    lock.lock();
+
+    // Queued catch-ups outlive a publish, so the entry is still there.
+    CatchUp& catch_up = catch_ups_[since];
+    catch_up.frame = std::move(frame);
+    std::vector<std::shared_ptr<Watcher>> waiting;
+    waiting.reserve(catch_up.waiting.size());
+    for (Watcher* watcher : catch_up.waiting) {
+      auto found = watchers_.find(watcher);
+      if (found != watchers_.end()) {
+        waiting.push_back(found->second);
+      }
+    }
+    catch_up.waiting.clear();
+    lock.unlock();
+    for (const std::shared_ptr<Watcher>& watcher : waiting) {
+      watcher->Pump();
+    }
+    lock.lock();
+  }
+}
+
+std::shared_ptr<const FeedFrame> ProductFeed::buildCatchUp(std::uint64_t since,
+                                                           std::uint64_t seq) {
+  auto frame = std::make_shared<FeedFrame>();
+  frame->seq = seq;
+  server::GetProductsRequest request;
+  request.set_since_version(since);
+  request.set_page_size(kMaxPageSize);
+  server::GetProductsResponse response;
+  do {
+    response.Clear();
+    service_.ListProducts(&request, &response);
+    if (frame->version == 0) {
+      frame->version = response.catalog_version();
+    }
+    if (response.products_size() != 0) {
+      server::ProductUpdates message;
+      message.mutable_products()->Swap(response.mutable_products());
+      if (response.next_page_token().empty()) {
+        message.set_catalog_version(frame->version);
+      }
+      frame->messages.push_back(Serialize(message));
+    }
+    request.set_page_token(response.next_page_token());
+  } while (!request.page_token().empty());
+  return frame;
+}
+
+void ProductFeed::remove(Watcher* watcher) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  watchers_.erase(watcher);
+}
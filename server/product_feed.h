@@ -0,0 +1,109 @@
+#ifndef PRODUCT_FEED_H
+#define PRODUCT_FEED_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+
+class AuctionService;
+
+struct ProductFeedOptions {
+  // How often changed products are gathered and sent to watchers.
+  std::chrono::milliseconds interval{50};
+  // Further WatchProducts calls fail with RESOURCE_EXHAUSTED.
+  std::size_t max_watchers = 10000;
+};
+
+// One batch of product updates, serialized once and sent as is to every
+// watcher: a sequence of ProductUpdates messages of at most kMaxPageSize
+// products each, of which only the last carries the catalog version.
+struct FeedFrame {
+  std::uint64_t seq = 0;
+  std::uint64_t version = 0;
+  std::vector<grpc::Slice> messages;
+};
+
+// Fans product changes out to WatchProducts streams. Every interval, the
+// products changed since the last pass are read once, serialized into a
+// frame and handed to every watcher that has sent everything before it.
+// A watcher whose last write is still in flight is not queued for: when it
+// completes, it is sent the latest state of every product changed since the
+// version it was last sent, in one frame that is shared with every other
+// watcher catching up from the same version. Memory therefore stays bounded
+// by the catalog, however slowly watchers read. Catch-ups are built on a
+// thread of their own, never in a gRPC reaction: a watcher whose catch-up
+// is not ready yet has no write in flight, and is pumped once it is. There
+// are at most a few catch-ups per frame; past that, a watcher is caught up
+// from an earlier version, which sends it more products but no new scan.
+//
+// Usage: SetProductFeed() on the service, Start() before serving; Stop()
+// finishes every stream, so call it before shutting the server down.
+class ProductFeed {
+public:
+  ProductFeed(AuctionService& service, ProductFeedOptions options);
+  ~ProductFeed();
+
+  ProductFeed(const ProductFeed&) = delete;
+  ProductFeed& operator=(const ProductFeed&) = delete;
+
+  void Start();
+  void Stop();
+
+  // The WatchProducts handler.
+  grpc::ServerWriteReactor<grpc::ByteBuffer>* Watch(grpc::CallbackServerContext* context,
+                                                    const grpc::ByteBuffer* request);
+  // A reactor that finishes at once with `status`.
+  static grpc::ServerWriteReactor<grpc::ByteBuffer>* Reject(grpc::Status status);
+
+  std::size_t WatcherCount() const;
+
+private:
+  class Watcher;
+
+  // A catch-up frame, null until built, and the watchers waiting for it.
+  struct CatchUp {
+    std::shared_ptr<const FeedFrame> frame;
+    std::unordered_set<Watcher*> waiting;
+  };
+
+  void run();
+  void publish();
+  // Builds the queued catch-ups and pumps the watchers waiting for them.
+  void runCatchUps();
+  // Picks what `watcher`, which has been sent up to `frame` and `version`,
+  // should be sent next, and moves both on; `out` is null if there is
+  // nothing to send yet. Never blocks: a catch-up not built yet is queued
+  // and the watcher pumped when it is.
+  void next(Watcher* watcher, std::uint64_t* frame, std::uint64_t* version,
+            std::shared_ptr<const FeedFrame>* out);
+  // Every product changed since version `since`, as a frame numbered `seq`.
+  std::shared_ptr<const FeedFrame> buildCatchUp(std::uint64_t since, std::uint64_t seq);
+  void remove(Watcher* watcher);
+
+  AuctionService& service_;
+  const ProductFeedOptions options_;
+
+  mutable std::mutex mutex_;  // guards everything below
+  std::condition_variable stop_cond_;
+  std::condition_variable catch_up_cond_;
+  bool stopping_ = false;
+  std::unordered_map<Watcher*, std::shared_ptr<Watcher>> watchers_;
+  std::shared_ptr<const FeedFrame> latest_;
+  // Catch-ups by the version they start from: built since latest_, or still
+  // to be built. A frame without messages means nothing changed since.
+  std::map<std::uint64_t, CatchUp> catch_ups_;
+  std::deque<std::uint64_t> queued_catch_ups_;  // keys of catch_ups_ to build
+  std::thread thread_;
+  std::thread catch_up_thread_;
+};
+
+#endif // PRODUCT_FEED_H
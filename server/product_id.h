@@ -0,0 +1,90 @@
+#ifndef PRODUCT_ID_H
+#define PRODUCT_ID_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+using ProductId = std::uint64_t;
+
+// IDs are milliseconds since kProductIdEpochMs in the high bits and a
+// sequence in the low kProductIdSequenceBits, so they sort by creation time.
+// Zero is never issued and means "no product".
+constexpr int kProductIdSequenceBits = 20;
+constexpr std::uint64_t kProductIdEpochMs = 1704067200000;  // 2024-01-01T00:00:00Z
+
+// Hands out strictly increasing IDs from any number of threads. When more
+// than 2^20 IDs are requested in one millisecond, the sequence carries into
+// the next millisecond rather than repeating.
+class ProductIdGenerator {
+public:
+  ProductId Next() {
+    std::uint64_t now = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    std::uint64_t floor = (now - kProductIdEpochMs) << kProductIdSequenceBits;
+    ProductId last = last_.load(std::memory_order_relaxed);
+    ProductId next;
+    do {
+      next = std::max(last + 1, floor);
+    } while (!last_.compare_exchange_weak(last, next, std::memory_order_relaxed));
+    return next;
+  }
+
+  // Makes every later ID larger than `id`, e.g. after loading saved state.
+  void AdvancePast(ProductId id) {
+    ProductId last = last_.load(std::memory_order_relaxed);
+    while (last < id && !last_.compare_exchange_weak(last, id, std::memory_order_relaxed)) {
+    }
+  }
+
+private:
+  std::atomic<ProductId> last_{0};
+};
+
+// Spreads IDs over shards; the low bits alone are mostly the sequence.
+inline std::size_t HashProductId(ProductId id) {
+  return static_cast<std::size_t>((id * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+// Display form shown to users, "PROD_<id>".
+inline std::string FormatProductId(ProductId id) {
+  return "PROD_" + std::to_string(id);
+}
+
+// Streams the display form without building a string.
+struct ProductIdText {
+  ProductId id;
+};
+
+inline std::ostream& operator<<(std::ostream& out, ProductIdText value) {
+  return out << "PROD_" << value.id;
+}
+
+// Accepts the display form or the bare number. Returns 0 if unparsable.
+inline ProductId ParseProductId(std::string_view text) {
+  if (text.substr(0, 5) == "PROD_") {
+    text.remove_prefix(5);
+  }
+  if (text.empty() || text.size() > 20) {
+    return 0;
+  }
+  ProductId id = 0;
+  for (char c : text) {
+    if (c < '0' || c > '9') {
+      return 0;
+    }
+    ProductId digit = static_cast<ProductId>(c - '0');
+    if (id > (UINT64_MAX - digit) / 10) {
+      return 0;
+    }
+    id = id * 10 + digit;
+  }
+  return id;
+}
+
+#endif // PRODUCT_ID_H
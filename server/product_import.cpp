@@ -0,0 +1,101 @@
+#include "product_import.h"
+#include <algorithm>
+#include <chrono>
+#include "auction_service.h"
+#include "logger.h"
+#include "tracer.h"
+
+using server::ImportProductsRequest;
+using server::ImportProductsResponse;
+
+namespace {
+
+class ProductImport final : public grpc::ServerReadReactor<ImportProductsRequest> {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  ProductImport(AuctionService& service, ImportProductsResponse* response)
+      : service_(service), response_(response) {
+    StartRead(&request_);
+  }
+
+  void OnReadDone(bool ok) override {
+    if (!ok) {
+      // The client is done sending, or the call was cancelled.
+      finish();
+      return;
+    }
+    if (chunks_++ == 0) {
+      started_ = Clock::now();
+    }
+    RpcTimer timer(RpcMethod::kImportProducts);
+    google::protobuf::RepeatedField<std::uint64_t>* ids = response_->mutable_product_ids();
+    int first = ids->size();
+    ids->Resize(first + request_.products_size(), 0);
+    WriteAheadLog::Lsn durable_at;
+    grpc::Status status;
+    {
+      TraceRequest trace("ImportProducts");
+      trace.Set("products", static_cast<std::uint64_t>(request_.products_size()));
+      status = service_.ApplyImportChunk(&request_, ids->mutable_data() + first, &durable_at);
+    }
+    timer.Mark(RpcPhase::kHandler);
+    timer.Finish();
+    if (!status.ok()) {
+      Finish(status);
+      return;
+    }
+    std::uint64_t imported = static_cast<std::uint64_t>(
+        std::count_if(ids->begin() + first, ids->end(), [](std::uint64_t id) { return id != 0; }));
+    response_->set_imported(response_->imported() + imported);
+    response_->set_rejected(response_->rejected() + (ids->size() - first) - imported);
+    RpcStats::Count(RpcCounter::kProductsImported, imported);
+
+    // The import's records become durable in the order it appended them.
+    WriteAheadLog::Lsn previous = last_lsn_;
+    last_lsn_ = std::max(last_lsn_, durable_at);
+    service_.WhenDurable(previous, [this](grpc::Status status) {
+      if (!status.ok()) {
+        Finish(status);
+        return;
+      }
+      StartRead(&request_);
+    });
+  }
+
+  void OnDone() override { delete this; }
+
+private:
+  void finish() {
+    service_.WhenDurable(last_lsn_, [this](grpc::Status status) {
+      if (!status.ok()) {
+        Finish(status);
+        return;
+      }
+      double seconds =
+          chunks_ != 0 ? std::chrono::duration<double>(Clock::now() - started_).count() : 0;
+      response_->set_seconds(seconds);
+      response_->set_products_per_second(
+          seconds > 0 ? static_cast<double>(response_->imported()) / seconds : 0);
+      Log(LogLevel::kInfo, "Imported {} products, {} rejected, in {} chunks and {} ms ({}/s)",
+          response_->imported(), response_->rejected(), chunks_,
+          static_cast<std::uint64_t>(seconds * 1000),
+          static_cast<std::uint64_t>(response_->products_per_second()));
+      Finish(grpc::Status::OK);
+    });
+  }
+
+  AuctionService& service_;
+  ImportProductsResponse* response_;
+  ImportProductsRequest request_;  // only touched by the read in flight
+  WriteAheadLog::Lsn last_lsn_ = 0;  // newest record appended
+  std::uint64_t chunks_ = 0;
+  Clock::time_point started_;
+};
+
+}  // namespace
+
+grpc::ServerReadReactor<ImportProductsRequest>* StartProductImport(
+    AuctionService& service, ImportProductsResponse* response) {
+  return new ProductImport(service, response);
+}
@@ -0,0 +1,18 @@
+#ifndef PRODUCT_IMPORT_H
+#define PRODUCT_IMPORT_H
+
+#include <grpcpp/grpcpp.h>
+#include "e-space.grpc.pb.h"
+
+class AuctionService;
+
+// The ImportProducts handler, for every server mode. Each chunk is inserted
+// as one batch as soon as it is read, and the next read starts once the
+// chunk before it is durable: inserting a chunk overlaps syncing the last
+// one, and nothing more than a chunk is held in memory. Until a read is
+// started, gRPC's flow control stops the client from sending more. The
+// response is sent once every product is durable.
+grpc::ServerReadReactor<server::ImportProductsRequest>* StartProductImport(
+    AuctionService& service, server::ImportProductsResponse* response);
+
+#endif // PRODUCT_IMPORT_H
@@ -0,0 +1,39 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// Paces background I/O to a byte rate so it does not starve the disk for
+// foreground writes. Acquire() sleeps until `bytes` more fit under the rate,
+// allowing a short burst after idle time. Not thread-safe.
+class RateLimiter {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // 0 means unlimited.
+  explicit RateLimiter(std::uint64_t bytes_per_second) : bytes_per_second_(bytes_per_second) {}
+
+  void Acquire(std::uint64_t bytes) {
+    if (bytes_per_second_ == 0) {
+      return;
+    }
+    Clock::time_point now = Clock::now();
+    next_free_ = std::max(next_free_, now - kBurst);
+    next_free_ += std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(bytes) / bytes_per_second_));
+    if (next_free_ > now) {
+      std::this_thread::sleep_until(next_free_);
+    }
+  }
+
+private:
+  static constexpr std::chrono::milliseconds kBurst{50};
+
+  const std::uint64_t bytes_per_second_;
+  Clock::time_point next_free_{};
+};
+
+#endif // RATE_LIMITER_H
@@ -0,0 +1,192 @@
+#include "rpc_stats.h"
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t kSlots = kRpcMethodCount * kRpcPhaseCount;
+
+std::size_t SlotOf(RpcMethod method, RpcPhase phase) {
+  return static_cast<std::size_t>(method) * kRpcPhaseCount + static_cast<std::size_t>(phase);
+}
+
+// One thread's numbers. Only the owning thread writes them.
+struct ThreadStats {
+  std::atomic<LatencyHistogram*> histograms[kSlots] = {};
+  std::atomic<std::uint64_t> counters[kRpcCounterCount] = {};
+
+  ~ThreadStats() {
+    for (std::atomic<LatencyHistogram*>& histogram : histograms) {
+      delete histogram.load(std::memory_order_relaxed);
+    }
+  }
+};
+
+struct StatsState {
+  std::mutex mutex;  // guards everything below
+  std::vector<ThreadStats*> threads;
+  // What exited threads recorded.
+  LatencyCounts retired[kSlots];
+  std::uint64_t retired_counters[kRpcCounterCount] = {};
+};
+
+// Never destroyed, so threads that outlive main() can still record and exit.
+StatsState& State() {
+  static StatsState* state = new StatsState();
+  return *state;
+}
+
+// Registers the thread's stats on first use and folds them into the retired
+// totals when the thread exits.
+struct ThreadStatsHolder {
+  std::unique_ptr<ThreadStats> stats;
+
+  ThreadStats& Get() {
+    if (stats == nullptr) {
+      stats = std::make_unique<ThreadStats>();
+      StatsState& state = State();
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.threads.push_back(stats.get());
+    }
+    return *stats;
+  }
+
+  ~ThreadStatsHolder() {
+    if (stats == nullptr) {
+      return;
+    }
+    StatsState& state = State();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (std::size_t slot = 0; slot < kSlots; ++slot) {
+      if (const LatencyHistogram* histogram = stats->histograms[slot].load()) {
+        state.retired[slot].Add(*histogram);
+      }
+    }
+    for (int i = 0; i < kRpcCounterCount; ++i) {
+      state.retired_counters[i] += stats->counters[i].load();
+    }
+    state.threads.erase(std::find(state.threads.begin(), state.threads.end(), stats.get()));
+  }
+};
+
+thread_local ThreadStatsHolder t_stats;
+
+}  // namespace
+
+const char* RpcMethodName(RpcMethod method) {
+  switch (method) {
+    case RpcMethod::kRegisterUser:
+      return "RegisterUser";
+    case RpcMethod::kAddProduct:
+      return "AddProduct";
+    case RpcMethod::kGetProducts:
+      return "GetProducts";
+    case RpcMethod::kPlaceBid:
+      return "PlaceBid";
+    case RpcMethod::kGetServerStats:
+      return "GetServerStats";
+    case RpcMethod::kDumpTrace:
+      return "DumpTrace";
+    case RpcMethod::kBidStream:
+      return "BidStream";
+    case RpcMethod::kAddProducts:
+      return "AddProducts";
+    case RpcMethod::kPlaceBids:
+      return "PlaceBids";
+    case RpcMethod::kImportProducts:
+      return "ImportProducts";
+  }
+  return "?";
+}
+
+const char* RpcPhaseName(RpcPhase phase) {
+  switch (phase) {
+    case RpcPhase::kHandler:
+      return "handler";
+    case RpcPhase::kLockWait:
+      return "lock_wait";
+    case RpcPhase::kLogWait:
+      return "log_wait";
+    case RpcPhase::kTotal:
+      return "total";
+  }
+  return "?";
+}
+
+void LatencyCounts::Add(const LatencyHistogram& histogram) {
+  for (std::size_t i = 0; i < counts_.size(); ++i) {
+    std::uint64_t count = histogram.counts_[i].load(std::memory_order_relaxed);
+    counts_[i] += count;
+    count_ += count;
+  }
+  sum_ += histogram.sum_.load(std::memory_order_relaxed);
+  max_ = std::max(max_, histogram.max_.load(std::memory_order_relaxed));
+}
+
+void LatencyCounts::Add(const LatencyCounts& other) {
+  for (std::size_t i = 0; i < counts_.size(); ++i) {
+    counts_[i] += other.counts_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  max_ = std::max(max_, other.max_);
+}
+
+std::uint64_t LatencyCounts::Percentile(double fraction) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  std::uint64_t rank =
+      static_cast<std::uint64_t>(std::ceil(fraction * static_cast<double>(count_)));
+  rank = std::max<std::uint64_t>(1, std::min(rank, count_));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < counts_.size(); ++i) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      return std::min(LatencyBuckets::UpperBound(i), max_);
+    }
+  }
+  return max_;
+}
+
+void RpcStats::Record(RpcMethod method, RpcPhase phase, std::uint64_t nanos) {
+  std::atomic<LatencyHistogram*>& slot = t_stats.Get().histograms[SlotOf(method, phase)];
+  LatencyHistogram* histogram = slot.load(std::memory_order_relaxed);
+  if (histogram == nullptr) {
+    histogram = new LatencyHistogram();
+    slot.store(histogram, std::memory_order_release);
+  }
+  histogram->Record(nanos);
+}
+
+void RpcStats::Count(RpcCounter counter, std::uint64_t by) {
+  std::atomic<std::uint64_t>& value = t_stats.Get().counters[static_cast<int>(counter)];
+  value.store(value.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+LatencyCounts RpcStats::Latency(RpcMethod method, RpcPhase phase) {
+  std::size_t slot = SlotOf(method, phase);
+  StatsState& state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  LatencyCounts counts = state.retired[slot];
+  for (const ThreadStats* thread : state.threads) {
+    if (const LatencyHistogram* histogram =
+            thread->histograms[slot].load(std::memory_order_acquire)) {
+      counts.Add(*histogram);
+    }
+  }
+  return counts;
+}
+
+std::uint64_t RpcStats::Total(RpcCounter counter) {
+  int index = static_cast<int>(counter);
+  StatsState& state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  std::uint64_t total = state.retired_counters[index];
+  for (const ThreadStats* thread : state.threads) {
+    total += thread->counters[index].load(std::memory_order_relaxed);
+  }
+  return total;
+}
@@ -0,0 +1,157 @@
+#ifndef RPC_STATS_H
+#define RPC_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+enum class RpcMethod : std::uint8_t {
+  kRegisterUser,
+  kAddProduct,
+  kGetProducts,
+  kPlaceBid,
+  kGetServerStats,
+  kDumpTrace,
+  kBidStream,  // one bid sent on a BidStream call
+  kAddProducts,
+  kPlaceBids,
+  kImportProducts,  // one chunk read on an ImportProducts call
+};
+constexpr int kRpcMethodCount = 10;
+
+// Where a call's time goes. Lock wait is the part of the handler time spent
+// blocked on a product's bid lock, so it is counted in both.
+enum class RpcPhase : std::uint8_t {
+  kHandler,   // applying the request in memory
+  kLockWait,  // blocked on a contended lock
+  kLogWait,   // waiting for the request's log record to become durable
+  kTotal,     // from entering the handler to handing gRPC the response
+};
+constexpr int kRpcPhaseCount = 4;
+
+enum class RpcCounter : std::uint8_t {
+  kBidsAccepted,
+  kBidsRejected,
+  kBidRetries,  // bid compare-and-swaps that failed and were retried
+  kProductsImported,
+};
+constexpr int kRpcCounterCount = 4;
+
+const char* RpcMethodName(RpcMethod method);
+const char* RpcPhaseName(RpcPhase phase);
+
+// Log-linear buckets in the manner of HdrHistogram: values below 32 get a
+// bucket each, and every power of two above is split into 16 equal buckets,
+// so a bucket is at most 1/16 as wide as the values in it. Values from
+// kMaxValue up share the last bucket.
+struct LatencyBuckets {
+  static constexpr int kSubBucketBits = 4;
+  static constexpr std::uint64_t kMaxValue = (std::uint64_t{1} << 40) - 1;  // ~18 minutes in ns
+  static constexpr std::size_t kCount = (40 - kSubBucketBits + 1) << kSubBucketBits;
+
+  static std::size_t Of(std::uint64_t value) {
+    value = std::min(value, kMaxValue);
+    int shift = std::max(0, 63 - __builtin_clzll(value | 1) - kSubBucketBits);
+    return (static_cast<std::size_t>(shift) << kSubBucketBits) + (value >> shift);
+  }
+
+  // The largest value that falls in `bucket`.
+  static std::uint64_t UpperBound(std::size_t bucket) {
+    int shift = bucket < (2u << kSubBucketBits)
+                    ? 0
+                    : static_cast<int>(bucket >> kSubBucketBits) - 1;
+    std::uint64_t top = bucket - (static_cast<std::size_t>(shift) << kSubBucketBits);
+    return ((top + 1) << shift) - 1;
+  }
+};
+
+// A histogram one thread records into and any thread may read. Recording is
+// a load and a store per counter, with no atomic read-modify-write.
+class LatencyHistogram {
+public:
+  void Record(std::uint64_t value) {
+    bump(counts_[LatencyBuckets::Of(value)], 1);
+    bump(sum_, value);
+    if (value > max_.load(std::memory_order_relaxed)) {
+      max_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  friend class LatencyCounts;
+
+  static void bump(std::atomic<std::uint64_t>& counter, std::uint64_t by) {
+    counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+  }
+
+  std::atomic<std::uint64_t> counts_[LatencyBuckets::kCount] = {};
+  std::atomic<std::uint64_t> sum_{0};
+  std::atomic<std::uint64_t> max_{0};
+};
+
+// Histograms added together for reading.
+class LatencyCounts {
+public:
+  void Add(const LatencyHistogram& histogram);
+  void Add(const LatencyCounts& other);
+
+  std::uint64_t count() const { return count_; }
+  std::uint64_t max() const { return max_; }
+  std::uint64_t Mean() const { return count_ != 0 ? sum_ / count_ : 0; }
+  // The value at or below which `fraction` of the recorded values fall, to
+  // within its bucket; 0 if nothing was recorded.
+  std::uint64_t Percentile(double fraction) const;
+
+private:
+  std::array<std::uint64_t, LatencyBuckets::kCount> counts_ = {};
+  std::uint64_t count_ = 0;
+  std::uint64_t sum_ = 0;
+  std::uint64_t max_ = 0;
+};
+
+// Process-wide RPC latencies and counters. Each thread records into its own
+// histograms, allocated on its first record for each method and phase, so
+// recording never contends; reads add up every thread's, including those
+// of threads that have exited.
+class RpcStats {
+public:
+  static void Record(RpcMethod method, RpcPhase phase, std::uint64_t nanos);
+  static void Count(RpcCounter counter, std::uint64_t by = 1);
+
+  static LatencyCounts Latency(RpcMethod method, RpcPhase phase);
+  static std::uint64_t Total(RpcCounter counter);
+};
+
+// Times one call's phases: Mark(phase) records the time since the previous
+// mark, or since construction, and Finish() the time since construction as
+// kTotal. Trivially copyable, so a continuation can carry it.
+class RpcTimer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit RpcTimer(RpcMethod method) : method_(method), started_(Clock::now()),
+                                        last_(started_) {}
+
+  void Mark(RpcPhase phase) {
+    Clock::time_point now = Clock::now();
+    RpcStats::Record(method_, phase, nanos(now - last_));
+    last_ = now;
+  }
+
+  void Finish() { RpcStats::Record(method_, RpcPhase::kTotal, nanos(Clock::now() - started_)); }
+
+private:
+  static std::uint64_t nanos(Clock::duration elapsed) {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+  RpcMethod method_;
+  Clock::time_point started_;
+  Clock::time_point last_;
+};
+
+#endif // RPC_STATS_H
@@ -0,0 +1,128 @@
+#ifndef SEGMENTED_ARRAY_H
+#define SEGMENTED_ARRAY_H
+
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+
+// An append-only array indexed by uint32. Storage is a directory of
+// 2^kSegmentBits-element segments allocated on first use, so appending never
+// moves or copies existing elements and a reference stays valid for the
+// array's lifetime. Appends are lock-free and safe from any number of threads.
+template <typename T, int kSegmentBits = 16>
+class SegmentedArray {
+public:
+  static constexpr std::uint32_t kSegmentSize = 1u << kSegmentBits;
+  static constexpr std::uint32_t kMaxSegments = 1u << 16;
+  // The top two uint32 values are left free for callers' sentinels.
+  static constexpr std::uint32_t kCapacity =
+      kSegmentBits >= 16 ? 0xFFFFFFFEu : kSegmentSize * kMaxSegments;
+  static constexpr std::uint32_t kFull = 0xFFFFFFFFu;
+
+  SegmentedArray() : segments_(new std::atomic<T*>[kMaxSegments]) {
+    for (std::uint32_t i = 0; i < kMaxSegments; ++i) {
+      segments_[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~SegmentedArray() {
+    for (std::uint32_t i = borrowed_segments_; i < kMaxSegments; ++i) {
+      delete[] segments_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  SegmentedArray(const SegmentedArray&) = delete;
+  SegmentedArray& operator=(const SegmentedArray&) = delete;
+
+  // Reserves the next slot and returns its index, or kFull. The slot holds a
+  // default-constructed T until the caller fills it in.
+  std::uint32_t Append() {
+    std::uint64_t index = size_.fetch_add(1, std::memory_order_relaxed);
+    if (index >= kCapacity) {
+      return kFull;
+    }
+    ensureSegment(static_cast<std::uint32_t>(index >> kSegmentBits));
+    return static_cast<std::uint32_t>(index);
+  }
+
+  // Allocates the segments that will hold the first `count` elements now,
+  // so appends up to there never allocate.
+  void Reserve(std::uint32_t count) {
+    std::uint32_t segments = std::min<std::uint64_t>(
+        (static_cast<std::uint64_t>(count) + kSegmentSize - 1) >> kSegmentBits, kMaxSegments);
+    for (std::uint32_t i = borrowed_segments_; i < segments; ++i) {
+      ensureSegment(i);
+    }
+  }
+
+  // Makes the first `count` elements those at `data`, e.g. a memory-mapped
+  // file, without copying whole segments: they point into `data`, which must
+  // outlive the array. Only the last, partial segment is copied so that later
+  // appends have room. Call on an empty array.
+  void Adopt(T* data, std::uint32_t count) {
+    static_assert(std::is_trivially_copyable<T>::value, "adopted elements are not copied");
+    std::uint32_t full = count >> kSegmentBits;
+    for (std::uint32_t i = 0; i < full; ++i) {
+      segments_[i].store(data + (static_cast<std::size_t>(i) << kSegmentBits),
+                         std::memory_order_relaxed);
+    }
+    borrowed_segments_ = full;
+    std::uint32_t tail = count & (kSegmentSize - 1);
+    if (tail != 0) {
+      T* segment = new T[kSegmentSize]();
+      std::copy(data + (static_cast<std::size_t>(full) << kSegmentBits), data + count, segment);
+      segments_[full].store(segment, std::memory_order_relaxed);
+    }
+    size_.store(count, std::memory_order_release);
+  }
+
+  // `index` must have been returned by Append().
+  T& operator[](std::uint32_t index) {
+    return segments_[index >> kSegmentBits].load(std::memory_order_acquire)
+        [index & (kSegmentSize - 1)];
+  }
+
+  const T& operator[](std::uint32_t index) const {
+    return segments_[index >> kSegmentBits].load(std::memory_order_acquire)
+        [index & (kSegmentSize - 1)];
+  }
+
+  // Like operator[], but nullptr while a concurrent Append() is still
+  // allocating `index`'s segment. For scans up to size() that race appends.
+  const T* Find(std::uint32_t index) const {
+    const T* segment = segments_[index >> kSegmentBits].load(std::memory_order_acquire);
+    return segment != nullptr ? &segment[index & (kSegmentSize - 1)] : nullptr;
+  }
+
+  // Slots handed out so far, including ones still being filled in.
+  std::uint32_t size() const {
+    std::uint64_t size = size_.load(std::memory_order_acquire);
+    return static_cast<std::uint32_t>(size < kCapacity ? size : kCapacity);
+  }
+
+  std::size_t MemoryBytes() const {
+    std::size_t segments = (size() + kSegmentSize - 1) >> kSegmentBits;
+    return segments * kSegmentSize * sizeof(T) + kMaxSegments * sizeof(std::atomic<T*>);
+  }
+
+private:
+  void ensureSegment(std::uint32_t segment) {
+    if (segments_[segment].load(std::memory_order_acquire) != nullptr) {
+      return;
+    }
+    T* fresh = new T[kSegmentSize]();
+    T* expected = nullptr;
+    if (!segments_[segment].compare_exchange_strong(expected, fresh,
+                                                    std::memory_order_acq_rel)) {
+      delete[] fresh;  // another appender installed it first
+    }
+  }
+
+  std::atomic<std::uint64_t> size_{0};
+  std::unique_ptr<std::atomic<T*>[]> segments_;
+  std::uint32_t borrowed_segments_ = 0;  // leading segments owned by Adopt()'s caller
+};
+
+#endif // SEGMENTED_ARRAY_H
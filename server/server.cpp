@@ -1,174 +1,255 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <string>
-#include <unordered_map>
-#include <vector>
-#include <mutex>
-#include <chrono>
+#include <thread>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include <grpcpp/grpcpp.h>
-#include "e-space.grpc.pb.h"
 #include <grpcpp/ext/proto_server_reflection_plugin.h>
+#include "async_server.h"
+#include "auction_service.h"
+#include "callback_service.h"
+#include "compactor.h"
+#include "logger.h"
+#include "product_feed.h"
+#include "tracer.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
-using grpc::ServerContext;
-using grpc::Status;
-using server::Auction;
-using server::RegisterUserRequest;
-using server::RegisterUserResponse;
-using server::AddProductRequest;
-using server::AddProductResponse;
-using server::GetProductsRequest;
-using server::GetProductsResponse;
-using server::ProductInfo;
-using server::PlaceBidRequest;
-using server::PlaceBidResponse;
 
-struct Product {
-  std::string id;
-  std::string name;
-  double initial_price;
-  double current_price;
-  std::string seller;
+enum class ServerMode {
+  kSync,      // gRPC's synchronous thread pool
+  kAsync,     // AsyncAuctionServer's completion queues
+  kCallback,  // CallbackAuctionService, which holds no thread while logging
 };
 
-struct Bid {
-  std::string bidder;
-  std::string product_id;
-  double amount;
+struct ServerOptions {
+  std::string addr = "0.0.0.0:50051";
+  ServerMode mode = ServerMode::kSync;
+  AsyncServerOptions async;
+  BidStrategy bid_strategy = BidStrategy::kCompareAndSwap;
+  // Empty keeps all state in memory only.
+  std::string data_dir = "auction-data";
+  SyncPolicy sync_policy = SyncPolicy::kEveryBatch;
+  int sync_interval_ms = 10;
+  int wal_batch = 0;
+  int wal_segment_mb = 64;
+  int snapshot_interval_s = 300;  // 0 disables the timer trigger
+  int compact_log_mb = 256;
+  int compaction_rate_mb = 64;    // 0 is unlimited
+  LoggerOptions log;
+  TracerOptions trace;
+  std::string trace_dir;  // empty: the data directory, or . without one
+  ProductFeedOptions feed;
 };
 
-class AuctionService final : public Auction::Service {
-private:
-  std::unordered_map<std::string, std::string> users_;
-  std::unordered_map<std::string, Product> products_;
-  std::vector<Bid> bids_;
-  std::mutex mutex_;
-
-  std::string generateProductId() {
-    auto now = std::chrono::system_clock::now();
-    auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-        now.time_since_epoch()).count();
-    return "PROD_" + std::to_string(timestamp);
-  }
-
-public:
-  Status RegisterUser(ServerContext* context,
-                     const RegisterUserRequest* request,
-                     RegisterUserResponse* response) override {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    std::string nickname = request->nickname();
-    std::cout << "[LOG] User registration: " << nickname << std::endl;
-    
-    if (users_.find(nickname) == users_.end()) {
-      users_[nickname] = nickname;
-      std::cout << "[LOG] User successfully registered: " << nickname << std::endl;
-      response->set_success(true);
+static bool ParseOptions(int argc, char** argv, ServerOptions& options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (std::strncmp(arg, "--addr=", 7) == 0) {
+      options.addr = arg + 7;
+    } else if (std::strcmp(arg, "--mode=sync") == 0) {
+      options.mode = ServerMode::kSync;
+    } else if (std::strcmp(arg, "--mode=async") == 0) {
+      options.mode = ServerMode::kAsync;
+    } else if (std::strcmp(arg, "--mode=callback") == 0) {
+      options.mode = ServerMode::kCallback;
+    } else if (std::strncmp(arg, "--cqs=", 6) == 0) {
+      options.async.completion_queues = std::atoi(arg + 6);
+    } else if (std::strncmp(arg, "--cq-threads=", 13) == 0) {
+      options.async.threads_per_queue = std::atoi(arg + 13);
+    } else if (std::strcmp(arg, "--pin-threads=0") == 0) {
+      options.async.pin_threads = false;
+    } else if (std::strcmp(arg, "--pin-threads=1") == 0) {
+      options.async.pin_threads = true;
+    } else if (std::strcmp(arg, "--bid-strategy=lock") == 0) {
+      options.bid_strategy = BidStrategy::kProductLock;
+    } else if (std::strcmp(arg, "--bid-strategy=cas") == 0) {
+      options.bid_strategy = BidStrategy::kCompareAndSwap;
+    } else if (std::strncmp(arg, "--data-dir=", 11) == 0) {
+      options.data_dir = arg + 11;
+    } else if (std::strcmp(arg, "--sync=batch") == 0) {
+      options.sync_policy = SyncPolicy::kEveryBatch;
+    } else if (std::strcmp(arg, "--sync=interval") == 0) {
+      options.sync_policy = SyncPolicy::kInterval;
+    } else if (std::strcmp(arg, "--sync=none") == 0) {
+      options.sync_policy = SyncPolicy::kNone;
+    } else if (std::strncmp(arg, "--sync-interval-ms=", 19) == 0) {
+      options.sync_interval_ms = std::atoi(arg + 19);
+    } else if (std::strncmp(arg, "--wal-batch=", 12) == 0) {
+      options.wal_batch = std::atoi(arg + 12);
+    } else if (std::strncmp(arg, "--wal-segment-mb=", 17) == 0) {
+      options.wal_segment_mb = std::atoi(arg + 17);
+    } else if (std::strncmp(arg, "--snapshot-interval-s=", 22) == 0) {
+      options.snapshot_interval_s = std::atoi(arg + 22);
+    } else if (std::strncmp(arg, "--compact-log-mb=", 17) == 0) {
+      options.compact_log_mb = std::atoi(arg + 17);
+    } else if (std::strncmp(arg, "--compaction-rate-mb=", 21) == 0) {
+      options.compaction_rate_mb = std::atoi(arg + 21);
+    } else if (std::strncmp(arg, "--watch-interval-ms=", 20) == 0) {
+      options.feed.interval = std::chrono::milliseconds(std::atoi(arg + 20));
+    } else if (std::strncmp(arg, "--max-watchers=", 15) == 0) {
+      options.feed.max_watchers = static_cast<std::size_t>(std::atoll(arg + 15));
+    } else if (std::strcmp(arg, "--log-level=debug") == 0) {
+      options.log.level = LogLevel::kDebug;
+    } else if (std::strcmp(arg, "--log-level=info") == 0) {
+      options.log.level = LogLevel::kInfo;
+    } else if (std::strcmp(arg, "--log-level=warning") == 0) {
+      options.log.level = LogLevel::kWarning;
+    } else if (std::strcmp(arg, "--log-level=error") == 0) {
+      options.log.level = LogLevel::kError;
+    } else if (std::strcmp(arg, "--log-level=off") == 0) {
+      options.log.level = LogLevel::kOff;
+    } else if (std::strncmp(arg, "--log-sample=", 13) == 0) {
+      options.log.sample_every = std::atoi(arg + 13);
+    } else if (std::strncmp(arg, "--trace-sample=", 15) == 0) {
+      options.trace.sample_every = std::atoi(arg + 15);
+    } else if (std::strncmp(arg, "--trace-dir=", 12) == 0) {
+      options.trace_dir = arg + 12;
     } else {
-      std::cout << "[LOG] User already exists: " << nickname << std::endl;
-      response->set_success(false);
+      std::cerr << "Unknown option: " << arg << std::endl;
+      std::cerr << "Usage: server [--addr=host:port] [--mode=sync|async|callback] [--cqs=N]"
+                << " [--cq-threads=N] [--pin-threads=0|1] [--bid-strategy=lock|cas]"
+                << " [--data-dir=DIR] [--sync=batch|interval|none]"
+                << " [--sync-interval-ms=N] [--wal-batch=N] [--wal-segment-mb=N]"
+                << " [--snapshot-interval-s=N] [--compact-log-mb=N] [--compaction-rate-mb=N]"
+                << " [--watch-interval-ms=N] [--max-watchers=N]"
+                << " [--log-level=debug|info|warning|error|off] [--log-sample=N]"
+                << " [--trace-sample=N] [--trace-dir=DIR]" << std::endl;
+      return false;
     }
-    
-    return Status::OK;
   }
+  return true;
+}
 
-  Status AddProduct(ServerContext* context,
-                   const AddProductRequest* request,
-                   AddProductResponse* response) override {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    std::string id = generateProductId();
-    Product product;
-    product.id = id;
-    product.name = request->name();
-    product.initial_price = request->initial_price();
-    product.current_price = request->initial_price();
-    product.seller = request->seller();
-    
-    products_[id] = product;
-    
-    std::cout << "[LOG] Product added by " << product.seller 
-              << ": " << product.name << " (ID: " << id << ")"
-              << " with initial price of " << product.initial_price << std::endl;
-    
-    response->set_success(true);
-    response->set_product_id(id);
-    
-    return Status::OK;
-  }
+// Blocks SIGUSR1 in the calling thread, and so in every thread started after,
+// and dumps a trace from a dedicated thread each time it arrives. Call before
+// starting any thread.
+static void DumpTraceOnSignal() {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  std::thread([signals] {
+    while (true) {
+      int signal;
+      if (sigwait(&signals, &signal) != 0) {
+        continue;
+      }
+      std::string path;
+      std::size_t spans = 0;
+      std::string error;
+      if (!Tracer::Enabled()) {
+        Log(LogLevel::kWarning, "SIGUSR1 ignored: tracing is off (--trace-sample=0)");
+      } else if (Tracer::Dump(&path, &spans, &error)) {
+        Log(LogLevel::kInfo, "Trace written to {}: {} spans", path, spans);
+      } else {
+        Log(LogLevel::kWarning, "Trace dump failed: {}", error);
+      }
+    }
+  }).detach();
+}
+
+void RunServer(const ServerOptions& options) {
+  AuctionService service(options.bid_strategy);
 
-  Status GetProducts(ServerContext* context,
-                    const GetProductsRequest* request,
-                    GetProductsResponse* response) override {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    std::cout << "[LOG] Products list requested, size: " << products_.size() << std::endl;
-    
-    for (const auto& pair : products_) {
-      const Product& product = pair.second;
-      ProductInfo* info = response->add_products();
-      info->set_id(product.id);
-      info->set_name(product.name);
-      info->set_initial_price(product.initial_price);
-      info->set_current_price(product.current_price);
-      info->set_seller(product.seller);
+  std::unique_ptr<WriteAheadLog> wal;
+  std::unique_ptr<Compactor> compactor;
+  if (!options.data_dir.empty()) {
+    if (::mkdir(options.data_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+      std::cerr << "Cannot create " << options.data_dir << ": " << std::strerror(errno)
+                << std::endl;
+      return;
+    }
+    std::string error;
+    std::string snapshot_path;
+    WriteAheadLog::Position wal_start;
+    if (!Compactor::ReadManifest(options.data_dir, &snapshot_path, &error) ||
+        (!snapshot_path.empty() && !service.LoadSnapshot(snapshot_path, &wal_start, &error))) {
+      std::cerr << "Cannot load snapshot: " << error << std::endl;
+      return;
+    }
+    if (!service.Recover(options.data_dir, wal_start, &error)) {
+      std::cerr << "Recovery failed: " << error << std::endl;
+      return;
     }
-    
-    return Status::OK;
-  }
 
-  Status PlaceBid(ServerContext* context,
-                 const PlaceBidRequest* request,
-                 PlaceBidResponse* response) override {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    std::string product_id = request->product_id();
-    std::string bidder = request->bidder();
-    double amount = request->amount();
-    
-    std::cout << "[LOG] " << bidder << " placed bid of $" << amount 
-              << " for product " << product_id << std::endl;
-    
-    auto it = products_.find(product_id);
-    if (it != products_.end() && amount > it->second.current_price) {
-      it->second.current_price = amount;
-      
-      Bid bid;
-      bid.bidder = bidder;
-      bid.product_id = product_id;
-      bid.amount = amount;
-      bids_.push_back(bid);
-      
-      std::cout << "[LOG] Bid placed successfully for product " << product_id 
-                << " new price: " << amount << std::endl;
-      response->set_success(true);
-    } else {
-      std::cout << "[LOG] Bid failed for product " << product_id 
-                << " amount: " << amount << std::endl;
-      response->set_success(false);
+    WalOptions wal_options;
+    wal_options.dir = options.data_dir;
+    wal_options.segment_bytes = static_cast<std::uint64_t>(options.wal_segment_mb) << 20;
+    wal_options.first_segment = wal_start.segment;
+    wal_options.sync_policy = options.sync_policy;
+    wal_options.sync_interval = std::chrono::milliseconds(options.sync_interval_ms);
+    wal_options.max_batch_records = static_cast<std::size_t>(options.wal_batch);
+    wal = std::make_unique<WriteAheadLog>(wal_options);
+    if (!wal->Open(&error)) {
+      std::cerr << "Cannot open write-ahead log: " << error << std::endl;
+      return;
     }
-    
-    return Status::OK;
+    service.SetWriteAheadLog(wal.get());
+
+    CompactionOptions compaction_options;
+    compaction_options.dir = options.data_dir;
+    compaction_options.interval = std::chrono::seconds(options.snapshot_interval_s);
+    compaction_options.log_bytes_trigger =
+        static_cast<std::uint64_t>(options.compact_log_mb) << 20;
+    compaction_options.max_bytes_per_second =
+        static_cast<std::uint64_t>(options.compaction_rate_mb) << 20;
+    compactor = std::make_unique<Compactor>(service, *wal, compaction_options);
+    compactor->Start();
   }
-};
 
-void RunServer() {
-  std::string addr = "0.0.0.0:50051";
-  AuctionService service;
-  
+  ProductFeed feed(service, options.feed);
+  service.SetProductFeed(&feed);
+  feed.Start();
+
   grpc::reflection::InitProtoReflectionServerBuilderPlugin();
   ServerBuilder builder;
-  builder.AddListeningPort(addr, grpc::InsecureServerCredentials());
-  builder.RegisterService(&service);
-  
+  builder.AddListeningPort(options.addr, grpc::InsecureServerCredentials());
+  std::unique_ptr<AsyncAuctionServer> async_server;
+  std::unique_ptr<CallbackAuctionService> callback_service;
+  switch (options.mode) {
+    case ServerMode::kSync:
+      builder.RegisterService(&service);
+      break;
+    case ServerMode::kAsync:
+      async_server = std::make_unique<AsyncAuctionServer>(service, options.async);
+      async_server->Register(builder);
+      break;
+    case ServerMode::kCallback:
+      callback_service = std::make_unique<CallbackAuctionService>(service);
+      builder.RegisterService(callback_service.get());
+      break;
+  }
+
   std::unique_ptr<Server> server(builder.BuildAndStart());
-  std::cout << "Auction Server listening on " << addr << std::endl;
-  
+  if (async_server != nullptr) {
+    async_server->Start();
+  }
+  static const char* const kModeNames[] = {"sync", "async", "callback"};
+  Log(LogLevel::kInfo, "Auction Server listening on {} ({})", options.addr,
+      kModeNames[static_cast<int>(options.mode)]);
+
   server->Wait();
 }
 
-int main() {
-  RunServer();
+int main(int argc, char** argv) {
+  ServerOptions options;
+  if (!ParseOptions(argc, argv, options)) {
+    return 1;
+  }
+  DumpTraceOnSignal();
+  Logger::Start(options.log);
+  options.trace.dir = !options.trace_dir.empty() ? options.trace_dir
+                      : !options.data_dir.empty() ? options.data_dir
+                                                  : ".";
+  Tracer::Start(options.trace);
+  RunServer(options);
+  Logger::Stop();
   return 0;
 }
@@ -0,0 +1,213 @@
+#include "snapshot.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "crc32.h"
+
+namespace {
+
+constexpr std::size_t kWriteBufferSize = 1 << 20;
+
+bool WriteAll(int fd, const char* data, std::size_t size) {
+  while (size > 0) {
+    ssize_t written = ::write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= static_cast<std::size_t>(written);
+  }
+  return true;
+}
+
+std::uint32_t HeaderCrc(SnapshotHeader header) {
+  header.header_crc = 0;
+  return Crc32c(&header, sizeof(header));
+}
+
+}  // namespace
+
+SnapshotString SnapshotStrings::Add(std::string_view value) {
+  SnapshotString ref;
+  ref.offset = static_cast<std::uint32_t>(data_.size());
+  ref.size = static_cast<std::uint32_t>(value.size());
+  data_.append(value.data(), value.size());
+  return ref;
+}
+
+SnapshotWriter::SnapshotWriter(std::string path)
+    : path_(std::move(path)), tmp_path_(path_ + ".tmp") {}
+
+SnapshotWriter::~SnapshotWriter() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+  if (!committed_) {
+    ::unlink(tmp_path_.c_str());
+  }
+}
+
+bool SnapshotWriter::Open(std::string* error) {
+  fd_ = ::open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    *error = "open " + tmp_path_ + ": " + std::strerror(errno);
+    return false;
+  }
+  // The header is written last, once every section's offset and CRC is known.
+  buffer_.assign(sizeof(SnapshotHeader), '\0');
+  offset_ = sizeof(SnapshotHeader);
+  return true;
+}
+
+void SnapshotWriter::BeginSection(std::size_t alignment) {
+  std::size_t padding = (alignment - offset_ % alignment) % alignment;
+  buffer_.append(padding, '\0');
+  offset_ += padding;
+  section_start_ = offset_;
+  section_crc_ = 0;
+}
+
+void SnapshotWriter::Write(const void* data, std::size_t size) {
+  section_crc_ = Crc32c(data, size, section_crc_);
+  buffer_.append(static_cast<const char*>(data), size);
+  offset_ += size;
+  if (buffer_.size() >= kWriteBufferSize) {
+    flush();
+  }
+}
+
+SnapshotSection SnapshotWriter::EndSection(std::uint64_t count) {
+  SnapshotSection section;
+  section.offset = section_start_;
+  section.count = count;
+  section.crc = section_crc_;
+  return section;
+}
+
+void SnapshotWriter::flush() {
+  if (limiter_ != nullptr) {
+    limiter_->Acquire(buffer_.size());
+  }
+  if (errno_ == 0 && !WriteAll(fd_, buffer_.data(), buffer_.size())) {
+    errno_ = errno;
+  }
+  buffer_.clear();
+}
+
+bool SnapshotWriter::Commit(SnapshotHeader& header, std::string* error) {
+  flush();
+  std::memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.version = kSnapshotVersion;
+  header.header_crc = HeaderCrc(header);
+  if (errno_ == 0 && ::pwrite(fd_, &header, sizeof(header), 0) != sizeof(header)) {
+    errno_ = errno;
+  }
+  if (errno_ == 0 && ::fdatasync(fd_) != 0) {
+    errno_ = errno;
+  }
+  if (errno_ != 0) {
+    *error = "write " + tmp_path_ + ": " + std::strerror(errno_);
+    return false;
+  }
+  ::close(fd_);
+  fd_ = -1;
+  if (::rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+    *error = "rename " + tmp_path_ + ": " + std::strerror(errno);
+    return false;
+  }
+  committed_ = true;
+
+  // Make the rename itself durable.
+  std::string dir = path_;
+  int dir_fd = ::open(::dirname(&dir[0]), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+  return true;
+}
+
+SnapshotFile::~SnapshotFile() {
+  if (data_ != nullptr) {
+    ::munmap(data_, size_);
+  }
+}
+
+bool SnapshotFile::checkSection(const SnapshotSection& section, std::size_t element_size,
+                                const char* name, std::string* error) const {
+  if (section.offset > size_ || section.count > (size_ - section.offset) / element_size) {
+    *error = std::string("snapshot ") + name + " section is out of bounds";
+    return false;
+  }
+  if (Crc32c(data_ + section.offset, section.count * element_size) != section.crc) {
+    *error = std::string("snapshot ") + name + " section is corrupt";
+    return false;
+  }
+  return true;
+}
+
+bool SnapshotFile::Open(const std::string& path, std::string* error) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    *error = "open " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    *error = "stat " + path + ": " + std::strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  if (static_cast<std::size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+    *error = path + " is too short to be a snapshot";
+    ::close(fd);
+    return false;
+  }
+  size_ = static_cast<std::size_t>(st.st_size);
+  void* data = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    *error = "mmap " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  data_ = static_cast<char*>(data);
+  // Verification reads the whole file front to back.
+  ::madvise(data_, size_, MADV_SEQUENTIAL);
+
+  const SnapshotHeader& h = header();
+  bool ok = true;
+  if (std::memcmp(h.magic, kSnapshotMagic, sizeof(h.magic)) != 0 ||
+      h.version != kSnapshotVersion) {
+    *error = path + " is not a version " + std::to_string(kSnapshotVersion) + " snapshot";
+    ok = false;
+  } else if (HeaderCrc(h) != h.header_crc) {
+    *error = "snapshot header is corrupt";
+    ok = false;
+  } else {
+    ok = checkSection(h.users, sizeof(std::uint32_t), "users", error) &&
+         checkSection(h.products, sizeof(SnapshotProduct), "products", error) &&
+         checkSection(h.names, sizeof(SnapshotString), "names", error) &&
+         checkSection(h.bids, sizeof(BidRecord), "bids", error) &&
+         checkSection(h.strings, 1, "strings", error);
+  }
+  if (!ok) {
+    ::munmap(data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+    return false;
+  }
+  ::madvise(data_, size_, MADV_NORMAL);
+  strings_ = data_ + h.strings.offset;
+  strings_size_ = h.strings.count;
+  return true;
+}
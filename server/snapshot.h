@@ -0,0 +1,160 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "bid_journal.h"
+#include "money.h"
+#include "product_id.h"
+#include "rate_limiter.h"
+
+// A snapshot is one file of fixed-layout sections that the server maps and
+// serves from directly: the bid section is BidRecord[] in memory layout, so
+// the journal points into the mapping instead of parsing it. All integers are
+// little-endian.
+//
+//   SnapshotHeader | users | products | names | bids (page aligned) | strings
+
+constexpr char kSnapshotMagic[8] = {'E', 'S', 'P', 'S', 'N', 'A', 'P', '\0'};
+constexpr std::uint32_t kSnapshotVersion = 3;
+
+// A string in the strings section. kNoString marks an absent entry.
+struct SnapshotString {
+  static constexpr std::uint32_t kNoString = 0xFFFFFFFFu;
+
+  std::uint32_t offset = kNoString;
+  std::uint32_t size = 0;
+};
+
+struct SnapshotProduct {
+  ProductId id;  // 0 for a slot whose product was still being added
+  Cents initial_price;
+  SnapshotString name;
+  std::uint32_t seller;  // handle into the names section
+  BidIndex top_bid;
+  std::uint32_t bid_count;
+  std::uint32_t reserved;
+};
+static_assert(sizeof(SnapshotProduct) == 40, "snapshot layout is fixed");
+
+struct SnapshotSection {
+  std::uint64_t offset = 0;
+  std::uint64_t count = 0;  // elements, or bytes for the strings section
+  std::uint32_t crc = 0;
+  std::uint32_t reserved = 0;
+};
+
+struct SnapshotHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t header_crc;  // over the header with this field zeroed
+  // Write-ahead log position the snapshot covers; replay resumes there.
+  std::uint64_t wal_segment;
+  std::uint64_t wal_offset;
+  SnapshotSection users;     // uint32[], the handle of each registered user
+  SnapshotSection products;  // SnapshotProduct[], indexed by Product::index
+  SnapshotSection names;     // SnapshotString[], indexed by name handle
+  SnapshotSection bids;      // BidRecord[], indexed by BidIndex
+  SnapshotSection strings;   // bytes referenced by SnapshotString
+};
+
+// Accumulates the strings section.
+class SnapshotStrings {
+public:
+  SnapshotString Add(std::string_view value);
+  const std::string& data() const { return data_; }
+
+private:
+  std::string data_;
+};
+
+// Writes a snapshot to `path`.tmp section by section and renames it over
+// `path` on Commit(), so a crash never leaves a half-written snapshot behind.
+class SnapshotWriter {
+public:
+  explicit SnapshotWriter(std::string path);
+  ~SnapshotWriter();
+
+  SnapshotWriter(const SnapshotWriter&) = delete;
+  SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+  bool Open(std::string* error);
+
+  // Paces writes through `limiter`, which must outlive the writer.
+  void SetRateLimiter(RateLimiter* limiter) { limiter_ = limiter; }
+
+  // Sections are written in order: BeginSection, any number of Write calls,
+  // then EndSection.
+  void BeginSection(std::size_t alignment);
+  void Write(const void* data, std::size_t size);
+  SnapshotSection EndSection(std::uint64_t count);
+
+  // Fills in the header's magic, version and CRC, syncs the file and
+  // atomically replaces `path` with it.
+  bool Commit(SnapshotHeader& header, std::string* error);
+
+  std::uint64_t bytes() const { return offset_; }
+
+private:
+  void flush();
+
+  const std::string path_;
+  const std::string tmp_path_;
+  int fd_ = -1;
+  RateLimiter* limiter_ = nullptr;
+  std::string buffer_;
+  std::uint64_t offset_ = 0;        // bytes written or buffered so far
+  std::uint64_t section_start_ = 0;
+  std::uint32_t section_crc_ = 0;
+  int errno_ = 0;                   // first write error
+  bool committed_ = false;
+};
+
+// A verified, memory-mapped snapshot. The mapping is private, so writes
+// (e.g. linking a replayed bid behind a mapped one) never reach the file.
+class SnapshotFile {
+public:
+  SnapshotFile() = default;
+  ~SnapshotFile();
+
+  SnapshotFile(const SnapshotFile&) = delete;
+  SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+  // Maps `path` and checks its header and every section CRC. A missing file
+  // is not an error; loaded() stays false.
+  bool Open(const std::string& path, std::string* error);
+
+  bool loaded() const { return data_ != nullptr; }
+  std::size_t size() const { return size_; }
+  const SnapshotHeader& header() const {
+    return *reinterpret_cast<const SnapshotHeader*>(data_);
+  }
+
+  template <typename T>
+  T* Section(const SnapshotSection& section) const {
+    return reinterpret_cast<T*>(data_ + section.offset);
+  }
+
+  // Empty for kNoString or an out-of-range reference; check Has() to tell
+  // an absent string from "".
+  std::string_view String(SnapshotString value) const {
+    if (!Has(value) || value.offset > strings_size_ || value.size > strings_size_ - value.offset) {
+      return std::string_view();
+    }
+    return std::string_view(strings_ + value.offset, value.size);
+  }
+  static bool Has(SnapshotString value) { return value.offset != SnapshotString::kNoString; }
+
+private:
+  bool checkSection(const SnapshotSection& section, std::size_t element_size,
+                    const char* name, std::string* error) const;
+
+  char* data_ = nullptr;
+  std::size_t size_ = 0;
+  const char* strings_ = nullptr;
+  std::size_t strings_size_ = 0;
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,173 @@
+// Recovery after bids placed the moment their product is listed. A bidder
+// thread follows the catalog and bids on each new product as soon as it
+// appears, while another thread adds products, so a bid's log record lands
+// as close behind its product's as the service allows. The log, alone or
+// after any of the snapshots taken during the run, must then rebuild every
+// product and every accepted bid. Exits non-zero on any mismatch.
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "auction_service.h"
+#include "logger.h"
+#include "wal.h"
+
+namespace {
+
+constexpr int kProducts = 20000;
+constexpr int kSnapshots = 8;
+
+int g_failures = 0;
+
+void Check(bool ok, const char* what) {
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    ++g_failures;
+  }
+}
+
+// Current price by product ID, for the whole catalog.
+std::map<ProductId, Cents> Prices(AuctionService& service) {
+  std::map<ProductId, Cents> prices;
+  server::GetProductsRequest request;
+  server::GetProductsResponse response;
+  service.ListProducts(&request, &response);
+  for (const server::ProductInfo& product : response.products()) {
+    prices[product.id()] = product.current_price_cents();
+  }
+  return prices;
+}
+
+struct Snapshot {
+  std::string path;
+  WriteAheadLog::Position covered;  // where replay resumes after it
+};
+
+// Adds kProducts products while a second thread bids on each one as soon as
+// it is listed, writing each of `snapshots` along the way.
+void Run(AuctionService& service, std::vector<Snapshot>& snapshots) {
+  std::atomic<bool> adding{true};
+  std::thread bidder([&] {
+    server::GetProductsRequest request;
+    request.set_page_size(kMaxPageSize);
+    server::GetProductsResponse response;
+    server::PlaceBidRequest bid;
+    bid.set_bidder("bidder");
+    server::PlaceBidResponse result;
+    WriteAheadLog::Lsn durable_at;
+    bool more = true;
+    while (more) {
+      more = adding.load();
+      response.Clear();
+      service.ListProducts(&request, &response);
+      for (const server::ProductInfo& product : response.products()) {
+        bid.set_product_id(product.id());
+        bid.set_amount_cents(product.initial_price_cents() + 1);
+        service.ApplyPlaceBid(&bid, &result, &durable_at);
+        Check(result.success(), "bid on a new product accepted");
+        request.set_page_token(std::to_string(product.id()));
+      }
+      more = more || !response.next_page_token().empty();
+    }
+  });
+
+  server::AddProductRequest request;
+  request.set_seller("seller");
+  request.set_initial_price_cents(100);
+  server::AddProductResponse response;
+  WriteAheadLog::Lsn durable_at;
+  for (int i = 0; i < kProducts; ++i) {
+    request.set_name("item " + std::to_string(i));
+    service.ApplyAddProduct(&request, &response, &durable_at);
+    Check(response.success(), "product added");
+    std::size_t next = static_cast<std::size_t>(i) * snapshots.size() / kProducts;
+    if (i % (kProducts / kSnapshots) == 0 && next < snapshots.size()) {
+      std::string error;
+      Check(service.WriteSnapshot(snapshots[next].path, nullptr, &snapshots[next].covered,
+                                  &error),
+            "snapshot written");
+    }
+  }
+  adding = false;
+  bidder.join();
+}
+
+void Recover(const std::string& dir, const Snapshot* snapshot,
+             const std::map<ProductId, Cents>& before, std::size_t bids) {
+  AuctionService recovered;
+  std::string error;
+  WriteAheadLog::Position start;
+  if (snapshot != nullptr) {
+    Check(recovered.LoadSnapshot(snapshot->path, &start, &error), "snapshot loaded");
+    Check(start.segment == snapshot->covered.segment && start.offset == snapshot->covered.offset,
+          "snapshot covers what WriteSnapshot() reported");
+  }
+  Check(recovered.Recover(dir, start, &error), "log replayed");
+  Check(recovered.BidCount() == bids, "every accepted bid recovered");
+  Check(Prices(recovered) == before, "every product recovered at its price");
+}
+
+void TestRecovery(const std::string& dir, bool with_snapshots) {
+  std::vector<Snapshot> snapshots;
+  for (int i = 0; with_snapshots && i < kSnapshots; ++i) {
+    snapshots.push_back({dir + "/snapshot-" + std::to_string(i) + ".bin", {}});
+  }
+  std::map<ProductId, Cents> before;
+  std::size_t bids;
+  {
+    AuctionService service;
+    WalOptions options;
+    options.dir = dir;
+    WriteAheadLog wal(options);
+    std::string error;
+    Check(wal.Open(&error), "log opened");
+    service.SetWriteAheadLog(&wal);
+    Run(service, snapshots);
+    wal.Close();
+    before = Prices(service);
+    bids = service.BidCount();
+  }
+  Check(before.size() == kProducts && bids == kProducts, "every product has its bid");
+
+  if (snapshots.empty()) {
+    Recover(dir, nullptr, before, bids);
+  }
+  for (const Snapshot& snapshot : snapshots) {
+    Recover(dir, &snapshot, before, bids);
+  }
+}
+
+std::string MakeTempDir() {
+  char path[] = "/tmp/espace-recovery-XXXXXX";
+  if (mkdtemp(path) == nullptr) {
+    std::perror("mkdtemp");
+    std::exit(1);
+  }
+  return path;
+}
+
+}  // namespace
+
+int main() {
+  // Warnings, such as records recovery could not apply, go to stderr.
+  LoggerOptions log_options;
+  log_options.level = LogLevel::kWarning;
+  log_options.fd = 2;
+  Logger::Start(log_options);
+  for (bool with_snapshots : {false, true}) {
+    std::string dir = MakeTempDir();
+    TestRecovery(dir, with_snapshots);
+    std::system(("rm -rf " + dir).c_str());
+  }
+  Logger::Stop();
+  if (g_failures != 0) {
+    std::fprintf(stderr, "%d checks failed\n", g_failures);
+    return 1;
+  }
+  std::printf("recovery_test passed\n");
+  return 0;
+}
@@ -0,0 +1,208 @@
+#include "tracer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+std::atomic<int> Tracer::sample_every_{0};
+thread_local std::uint64_t Tracer::current_ = 0;
+
+namespace {
+
+// Exited threads' buffers kept for the next dump; older ones are freed.
+constexpr std::size_t kRetiredBuffers = 16;
+
+// One thread's newest spans. The owning thread writes under `mutex`, which
+// only a dump ever contends for.
+struct TraceBuffer {
+  std::mutex mutex;
+  std::vector<TraceSpanRecord> spans;  // a ring once full
+  std::uint64_t recorded = 0;
+  std::uint32_t thread = 0;
+  std::string name;
+  std::atomic<bool> closed{false};
+};
+
+struct TraceState {
+  std::mutex mutex;  // guards everything below
+  TracerOptions options;
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+  std::uint32_t next_thread = 1;
+  std::uint64_t dumps = 0;
+  std::atomic<std::uint64_t> next_request{1};
+};
+
+// Never destroyed, so threads that outlive main() can still record and exit.
+TraceState& State() {
+  static TraceState* state = new TraceState();
+  return *state;
+}
+
+// Owns the thread's reference to its buffer and marks it closed at thread
+// exit; the buffer itself is kept for the next dump.
+struct ThreadBufferHolder {
+  std::shared_ptr<TraceBuffer> buffer;
+
+  TraceBuffer& Get() {
+    if (buffer == nullptr) {
+      TraceState& state = State();
+      std::lock_guard<std::mutex> lock(state.mutex);
+      buffer = std::make_shared<TraceBuffer>();
+      buffer->spans.resize(std::max<std::size_t>(1, state.options.thread_spans));
+      buffer->thread = state.next_thread++;
+      std::size_t closed = 0;
+      for (std::size_t i = state.buffers.size(); i-- > 0;) {
+        if (state.buffers[i]->closed.load() && ++closed > kRetiredBuffers) {
+          state.buffers.erase(state.buffers.begin() + static_cast<std::ptrdiff_t>(i));
+        }
+      }
+      state.buffers.push_back(buffer);
+    }
+    return *buffer;
+  }
+
+  ~ThreadBufferHolder() {
+    if (buffer != nullptr) {
+      buffer->closed.store(true);
+    }
+  }
+};
+
+thread_local ThreadBufferHolder t_buffer;
+thread_local int t_unsampled = 0;
+
+void AppendMicros(std::string& out, std::int64_t ns) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%" PRId64 ".%03" PRId64, ns / 1000, ns % 1000);
+  out += text;
+}
+
+}  // namespace
+
+void Tracer::Start(TracerOptions options) {
+  TraceState& state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  sample_every_.store(std::max(0, options.sample_every), std::memory_order_relaxed);
+  state.options = std::move(options);
+}
+
+bool Tracer::Sample() {
+  int every = sample_every_.load(std::memory_order_relaxed);
+  if (every == 0 || ++t_unsampled < every) {
+    return false;
+  }
+  t_unsampled = 0;
+  return true;
+}
+
+void Tracer::Record(const TraceSpanRecord& span) {
+  TraceBuffer& buffer = t_buffer.Get();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  buffer.spans[buffer.recorded++ % buffer.spans.size()] = span;
+}
+
+void Tracer::SetThreadName(const char* name) {
+  if (!Enabled()) {
+    return;
+  }
+  TraceBuffer& buffer = t_buffer.Get();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  buffer.name = name;
+}
+
+bool Tracer::Dump(std::string* path, std::size_t* spans, std::string* error) {
+  TraceState& state = State();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    char name[64];
+    std::snprintf(name, sizeof(name), "/trace-%d-%06" PRIu64 ".json",
+                  static_cast<int>(::getpid()), ++state.dumps);
+    *path = state.options.dir + name;
+  }
+  return WriteChromeTrace(*path, spans, error);
+}
+
+bool Tracer::WriteChromeTrace(const std::string& path, std::size_t* spans,
+                              std::string* error) {
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+  {
+    TraceState& state = State();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    buffers = state.buffers;
+  }
+
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  out += "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"e-space\"}}";
+  std::size_t count = 0;
+  std::vector<TraceSpanRecord> copied;
+  for (const std::shared_ptr<TraceBuffer>& buffer : buffers) {
+    std::string name;
+    {
+      std::lock_guard<std::mutex> lock(buffer->mutex);
+      std::size_t kept = static_cast<std::size_t>(
+          std::min<std::uint64_t>(buffer->recorded, buffer->spans.size()));
+      copied.assign(buffer->spans.begin(), buffer->spans.begin() + kept);
+      name = buffer->name;
+    }
+    if (name.empty()) {
+      name = "thread " + std::to_string(buffer->thread);
+    }
+    std::string tid = std::to_string(buffer->thread);
+    out += ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":" + tid +
+           ",\"name\":\"thread_name\",\"args\":{\"name\":\"" + name + "\"}}";
+    for (const TraceSpanRecord& span : copied) {
+      out += ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" + tid + ",\"name\":\"";
+      out += span.name;
+      out += "\",\"ts\":";
+      AppendMicros(out, span.start_ns);
+      out += ",\"dur\":";
+      AppendMicros(out, std::max<std::int64_t>(0, span.end_ns - span.start_ns));
+      out += ",\"args\":{\"request\":" + std::to_string(span.request);
+      if (span.arg_name != nullptr) {
+        out += ",\"";
+        out += span.arg_name;
+        out += "\":" + std::to_string(span.arg);
+      }
+      out += "}}";
+    }
+    count += copied.size();
+  }
+  out += "\n]}\n";
+
+  std::FILE* file = std::fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    *error = "cannot create " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  bool ok = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok) {
+    *error = "cannot write " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  *spans = count;
+  return true;
+}
+
+TraceRequest::TraceRequest(const char* name, bool sampled)
+    : name_(name), outer_(Tracer::current_) {
+  if (sampled) {
+    // Allocated before the clock starts, so it does not show in the trace.
+    t_buffer.Get();
+    id_ = State().next_request.fetch_add(1, std::memory_order_relaxed);
+    start_ns_ = Tracer::Now();
+    Tracer::current_ = id_;
+  }
+}
+
+TraceRequest::~TraceRequest() {
+  if (id_ != 0) {
+    Tracer::Record({name_, id_, start_ns_, Tracer::Now(), arg_name_, arg_});
+    Tracer::current_ = outer_;
+  }
+}
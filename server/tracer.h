@@ -0,0 +1,131 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct TracerOptions {
+  // Traces one request in N, counted per thread; 0 turns tracing off.
+  int sample_every = 0;
+  // Newest spans kept per thread; older ones are overwritten.
+  std::size_t thread_spans = 4096;
+  // Where Dump() writes its files.
+  std::string dir = ".";
+};
+
+// A finished span. Names and argument names must outlive the tracer, i.e.
+// be literals.
+struct TraceSpanRecord {
+  const char* name;
+  std::uint64_t request;  // the traced request it belongs to
+  std::int64_t start_ns;  // steady clock
+  std::int64_t end_ns;
+  const char* arg_name;   // nullptr if the span has no argument
+  std::uint64_t arg;
+};
+
+// Process-wide request tracer. A sampled request gets an ID for as long as
+// its TraceRequest is in scope, and every TraceSpan opened on that thread
+// meanwhile is recorded under it. Spans go into a fixed-size buffer per
+// thread, so tracing keeps the newest spans of each thread and costs an
+// unsampled request one thread-local load per span.
+//
+// Dump() writes the buffers as Chrome trace JSON, which chrome://tracing and
+// ui.perfetto.dev open as one timeline row per thread.
+class Tracer {
+public:
+  // Call before serving.
+  static void Start(TracerOptions options);
+  static bool Enabled() { return sample_every_.load(std::memory_order_relaxed) != 0; }
+
+  // Whether the calling thread's next request should be traced.
+  static bool Sample();
+  // The traced request the calling thread is working on, 0 if none.
+  static std::uint64_t Current() { return current_; }
+
+  static std::int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Records a span on the calling thread's row; for time that was not spent
+  // in one scope, e.g. a request waiting on another thread.
+  static void Record(const TraceSpanRecord& span);
+
+  // Names the calling thread's row in dumps. Does nothing while tracing is
+  // off.
+  static void SetThreadName(const char* name);
+
+  // Writes every thread's spans to a new file in the options' dir and sets
+  // `path` to it and `spans` to the number written.
+  static bool Dump(std::string* path, std::size_t* spans, std::string* error);
+  static bool WriteChromeTrace(const std::string& path, std::size_t* spans,
+                               std::string* error);
+
+private:
+  friend class TraceRequest;
+
+  static std::atomic<int> sample_every_;
+  static thread_local std::uint64_t current_;
+};
+
+// The span of one request, and the scope in which the thread's spans belong
+// to it. Nests: an inner request on the same thread takes over until it ends.
+class TraceRequest {
+public:
+  explicit TraceRequest(const char* name) : TraceRequest(name, Tracer::Sample()) {}
+  TraceRequest(const char* name, bool sampled);
+  ~TraceRequest();
+
+  TraceRequest(const TraceRequest&) = delete;
+  TraceRequest& operator=(const TraceRequest&) = delete;
+
+  void Set(const char* arg_name, std::uint64_t arg) {
+    arg_name_ = arg_name;
+    arg_ = arg;
+  }
+
+private:
+  const char* name_;
+  std::uint64_t id_ = 0;
+  std::uint64_t outer_;
+  std::int64_t start_ns_ = 0;
+  const char* arg_name_ = nullptr;
+  std::uint64_t arg_ = 0;
+};
+
+// A step of the current request, recorded when it goes out of scope if the
+// request is traced.
+class TraceSpan {
+public:
+  explicit TraceSpan(const char* name) : name_(name), request_(Tracer::Current()) {
+    if (request_ != 0) {
+      start_ns_ = Tracer::Now();
+    }
+  }
+  ~TraceSpan() {
+    if (request_ != 0) {
+      Tracer::Record({name_, request_, start_ns_, Tracer::Now(), arg_name_, arg_});
+    }
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  void Set(const char* arg_name, std::uint64_t arg) {
+    arg_name_ = arg_name;
+    arg_ = arg;
+  }
+
+private:
+  const char* name_;
+  std::uint64_t request_;
+  std::int64_t start_ns_ = 0;
+  const char* arg_name_ = nullptr;
+  std::uint64_t arg_ = 0;
+};
+
+#endif // TRACER_H
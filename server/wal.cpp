@@ -0,0 +1,474 @@
+#include "wal.h"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "crc32.h"
+#include "tracer.h"
+
+namespace {
+
+// Initial room in the queue and in the writer's batch buffer, which trade
+// places each pass. Both only grow past this when the queue backs up, so a
+// steady stream of appends does not allocate.
+constexpr std::size_t kQueueBytes = 64 << 10;
+constexpr std::size_t kQueueRecords = 1024;
+
+}  // namespace
+
+WriteAheadLog::WriteAheadLog(WalOptions options) : options_(std::move(options)) {
+  pending_.reserve(kQueueBytes);
+  pending_ends_.reserve(kQueueRecords);
+  pending_segments_.reserve(kQueueRecords);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  Close();
+}
+
+std::string WriteAheadLog::SegmentPath(const std::string& dir, std::uint64_t segment) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "/wal-%06" PRIu64 ".log", segment);
+  return dir + name;
+}
+
+std::vector<std::uint64_t> WriteAheadLog::ListSegments(const std::string& dir) {
+  std::vector<std::uint64_t> segments;
+  DIR* handle = ::opendir(dir.c_str());
+  if (handle == nullptr) {
+    return segments;
+  }
+  while (dirent* entry = ::readdir(handle)) {
+    std::uint64_t segment;
+    char tail;
+    if (std::sscanf(entry->d_name, "wal-%" SCNu64 ".lo%c", &segment, &tail) == 2 &&
+        tail == 'g' && SegmentPath(dir, segment) == dir + "/" + entry->d_name) {
+      segments.push_back(segment);
+    }
+  }
+  ::closedir(handle);
+  std::sort(segments.begin(), segments.end());
+  return segments;
+}
+
+bool WriteAheadLog::openSegment(std::uint64_t segment, std::string* error) {
+  std::string path = SegmentPath(options_.dir, segment);
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    *error = "open " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  // Make the new file's directory entry durable before records land in it.
+  int dir_fd = ::open(options_.dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+  std::lock_guard<std::mutex> lock(fd_mutex_);
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+  fd_ = fd;
+  fd_segment_ = segment;
+  return true;
+}
+
+bool WriteAheadLog::Open(std::string* error) {
+  std::vector<std::uint64_t> segments = ListSegments(options_.dir);
+  std::uint64_t segment = std::max(segments.empty() ? 1 : segments.back() + 1,
+                                   options_.first_segment);
+  if (!openSegment(segment, error)) {
+    return false;
+  }
+  tail_segment_ = segment;
+  tail_offset_ = 0;
+  writer_ = std::thread(&WriteAheadLog::writerLoop, this);
+  return true;
+}
+
+WriteAheadLog::Lsn WriteAheadLog::Append(WalRecordType type, std::string_view payload) {
+  std::uint32_t size = static_cast<std::uint32_t>(payload.size());
+  std::uint8_t type_byte = static_cast<std::uint8_t>(type);
+  std::uint32_t crc = Crc32c(&type_byte, 1);
+  crc = Crc32c(payload.data(), payload.size(), crc);
+
+  bool traced = Tracer::Current() != 0;
+  Lsn lsn;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    pending_.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    pending_.push_back(static_cast<char>(type_byte));
+    pending_.append(payload.data(), payload.size());
+    pending_ends_.push_back(pending_.size());
+    if (tail_offset_ >= options_.segment_bytes) {
+      ++tail_segment_;
+      tail_offset_ = 0;
+    }
+    pending_segments_.push_back(tail_segment_);
+    tail_offset_ += kHeaderSize + size;
+    lsn = next_lsn_++;
+    if (traced) {
+      traced_lsn_ = lsn;
+    }
+  }
+  work_cond_.notify_one();
+  return lsn;
+}
+
+WriteAheadLog::Lsn WriteAheadLog::Append(WalRecordType type,
+                                         const std::vector<std::string>& payloads) {
+  if (payloads.empty()) {
+    return 0;
+  }
+  std::uint8_t type_byte = static_cast<std::uint8_t>(type);
+  std::uint32_t type_crc = Crc32c(&type_byte, 1);
+  std::vector<std::uint32_t> crcs;
+  crcs.reserve(payloads.size());
+  for (const std::string& payload : payloads) {
+    crcs.push_back(Crc32c(payload.data(), payload.size(), type_crc));
+  }
+
+  bool traced = Tracer::Current() != 0;
+  Lsn lsn;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::size_t i = 0; i < payloads.size(); ++i) {
+      std::uint32_t size = static_cast<std::uint32_t>(payloads[i].size());
+      pending_.append(reinterpret_cast<const char*>(&size), sizeof(size));
+      pending_.append(reinterpret_cast<const char*>(&crcs[i]), sizeof(crcs[i]));
+      pending_.push_back(static_cast<char>(type_byte));
+      pending_.append(payloads[i]);
+      pending_ends_.push_back(pending_.size());
+      if (tail_offset_ >= options_.segment_bytes) {
+        ++tail_segment_;
+        tail_offset_ = 0;
+      }
+      pending_segments_.push_back(tail_segment_);
+      tail_offset_ += kHeaderSize + size;
+    }
+    next_lsn_ += payloads.size();
+    lsn = next_lsn_ - 1;
+    if (traced) {
+      traced_lsn_ = lsn;
+    }
+  }
+  work_cond_.notify_one();
+  return lsn;
+}
+
+bool WriteAheadLog::WaitDurable(Lsn lsn) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  durable_cond_.wait(lock, [&] { return durable_lsn_ >= lsn || failed_; });
+  return durable_lsn_ >= lsn;
+}
+
+void WriteAheadLog::WhenDurable(Lsn lsn, std::function<void(bool)> done) {
+  bool ok;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ok = durable_lsn_ >= lsn;
+    if (!ok && !failed_ && !writer_done_) {
+      waiters_.emplace(lsn, std::move(done));
+      return;
+    }
+  }
+  done(ok);
+}
+
+WriteAheadLog::Position WriteAheadLog::Tail() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Position tail;
+  tail.lsn = next_lsn_ - 1;
+  tail.segment = tail_segment_;
+  tail.offset = tail_offset_;
+  return tail;
+}
+
+bool WriteAheadLog::Sync() {
+  // Finished segments were synced when the writer moved past them.
+  std::lock_guard<std::mutex> lock(fd_mutex_);
+  return fd_ >= 0 && ::fdatasync(fd_) == 0;
+}
+
+void WriteAheadLog::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_cond_.notify_one();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+  // Sync() may still be running, e.g. from the compactor.
+  std::lock_guard<std::mutex> lock(fd_mutex_);
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+WriteAheadLog::Stats WriteAheadLog::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+bool WriteAheadLog::writeAll(const char* data, std::size_t size) {
+  while (size > 0) {
+    ssize_t written = ::write(fd_, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= static_cast<std::size_t>(written);
+  }
+  return true;
+}
+
+void WriteAheadLog::writerLoop() {
+  Tracer::SetThreadName("wal writer");
+  std::string batch;
+  batch.reserve(kQueueBytes);
+  auto last_sync = std::chrono::steady_clock::now();
+  bool unsynced = false;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    auto has_work = [&] { return stopping_ || !pending_ends_.empty(); };
+    if (options_.sync_policy == SyncPolicy::kInterval && unsynced) {
+      work_cond_.wait_until(lock, last_sync + options_.sync_interval, has_work);
+    } else {
+      work_cond_.wait(lock, has_work);
+    }
+
+    // Take the next batch: everything queued for one segment, or the first
+    // max_batch_records of it.
+    std::size_t count = pending_ends_.size();
+    if (options_.max_batch_records != 0) {
+      count = std::min(count, options_.max_batch_records);
+    }
+    std::uint64_t batch_segment = count != 0 ? pending_segments_[0] : fd_segment_;
+    count = static_cast<std::size_t>(
+        std::find_if(pending_segments_.begin(), pending_segments_.begin() + count,
+                     [&](std::uint64_t segment) { return segment != batch_segment; }) -
+        pending_segments_.begin());
+    Lsn batch_end = durable_lsn_ + count;
+    bool traced = traced_lsn_ > durable_lsn_ && traced_lsn_ <= batch_end;
+    if (count == pending_ends_.size()) {
+      batch.swap(pending_);
+      pending_.clear();
+      pending_ends_.clear();
+      pending_segments_.clear();
+    } else {
+      std::size_t bytes = pending_ends_[count - 1];
+      batch.assign(pending_, 0, bytes);
+      pending_.erase(0, bytes);
+      pending_ends_.erase(pending_ends_.begin(), pending_ends_.begin() + count);
+      pending_segments_.erase(pending_segments_.begin(), pending_segments_.begin() + count);
+      for (std::size_t& end : pending_ends_) {
+        end -= bytes;
+      }
+    }
+    bool stopping = stopping_;
+    if (count == 0 && !unsynced && stopping) {
+      break;
+    }
+    lock.unlock();
+
+    TraceRequest trace("wal_batch", traced);
+    trace.Set("records", count);
+    bool ok = !failed_;
+    bool rotated = false;
+    if (ok && batch_segment != fd_segment_) {
+      TraceSpan span("rotate_segment");
+      // The finished segment is synced whatever the policy, so a torn
+      // record can only ever be at the end of the last segment.
+      std::string error;
+      ok = ::fdatasync(fd_) == 0 && openSegment(batch_segment, &error);
+      rotated = true;
+    }
+    if (ok && !batch.empty()) {
+      TraceSpan span("write");
+      span.Set("bytes", batch.size());
+      ok = writeAll(batch.data(), batch.size());
+      unsynced = true;
+    }
+    bool sync = false;
+    if (ok && unsynced) {
+      switch (options_.sync_policy) {
+        case SyncPolicy::kEveryBatch:
+          sync = true;
+          break;
+        case SyncPolicy::kInterval:
+          sync = stopping ||
+                 std::chrono::steady_clock::now() - last_sync >= options_.sync_interval;
+          break;
+        case SyncPolicy::kNone:
+          unsynced = false;
+          break;
+      }
+    }
+    if (sync) {
+      TraceSpan span("fdatasync");
+      ok = ::fdatasync(fd_) == 0;
+      last_sync = std::chrono::steady_clock::now();
+      unsynced = false;
+    }
+
+    lock.lock();
+    if (!ok) {
+      failed_ = true;
+    } else {
+      durable_lsn_ = batch_end;
+    }
+    if (count != 0) {
+      stats_.records += count;
+      stats_.batches += 1;
+      stats_.bytes += batch.size();
+    }
+    stats_.syncs += sync + rotated;
+    batch.clear();
+    durable_cond_.notify_all();
+    TraceSpan span("notify_waiters");
+    notifyWaiters(lock);
+  }
+  writer_done_ = true;
+  notifyWaiters(lock);
+}
+
+void WriteAheadLog::notifyWaiters(std::unique_lock<std::mutex>& lock) {
+  auto settled = failed_ || writer_done_ ? waiters_.end() : waiters_.upper_bound(durable_lsn_);
+  if (settled == waiters_.begin()) {
+    return;
+  }
+  std::vector<std::pair<Lsn, std::function<void(bool)>>> ready;
+  for (auto it = waiters_.begin(); it != settled; ++it) {
+    ready.emplace_back(it->first, std::move(it->second));
+  }
+  waiters_.erase(waiters_.begin(), settled);
+  Lsn durable = durable_lsn_;
+  lock.unlock();
+  for (auto& waiter : ready) {
+    waiter.second(waiter.first <= durable);
+  }
+  lock.lock();
+}
+
+bool WriteAheadLog::Replay(const std::string& dir, const Position& start,
+                           const std::function<void(WalRecordType, std::string_view)>& fn,
+                           std::string* error) {
+  std::vector<std::uint64_t> segments = ListSegments(dir);
+  segments.erase(segments.begin(),
+                 std::lower_bound(segments.begin(), segments.end(), start.segment));
+  if (start.segment != 0 && start.offset != 0 &&
+      (segments.empty() || segments.front() != start.segment)) {
+    *error = SegmentPath(dir, start.segment) + " is missing";
+    return false;
+  }
+  for (std::size_t i = 0; i < segments.size(); ++i) {
+    if (i != 0 && segments[i] != segments[i - 1] + 1) {
+      *error = SegmentPath(dir, segments[i - 1] + 1) + " is missing";
+      return false;
+    }
+    std::uint64_t offset = segments[i] == start.segment ? start.offset : 0;
+    if (!replaySegment(SegmentPath(dir, segments[i]), offset, i + 1 == segments.size(), fn,
+                       error)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool WriteAheadLog::replaySegment(const std::string& path, std::uint64_t start_offset,
+                                  bool last,
+                                  const std::function<void(WalRecordType, std::string_view)>& fn,
+                                  std::string* error) {
+  int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    *error = "open " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    *error = "stat " + path + ": " + std::strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  if (static_cast<std::uint64_t>(st.st_size) < start_offset ||
+      ::lseek(fd, static_cast<off_t>(start_offset), SEEK_SET) < 0) {
+    *error = path + " ends before offset " + std::to_string(start_offset);
+    ::close(fd);
+    return false;
+  }
+
+  std::string buffer;
+  std::size_t start = 0;   // first unconsumed byte in buffer
+  off_t consumed = static_cast<off_t>(start_offset);  // end of the last good record
+  bool eof = false;
+  char chunk[1 << 16];
+  while (true) {
+    // Parse every complete record in the buffer.
+    while (buffer.size() - start >= kHeaderSize) {
+      std::uint32_t size;
+      std::uint32_t crc;
+      std::memcpy(&size, buffer.data() + start, sizeof(size));
+      std::memcpy(&crc, buffer.data() + start + 4, sizeof(crc));
+      if (size > kMaxRecordSize) {
+        eof = true;  // a garbage length: treat as the end of the log
+        break;
+      }
+      if (buffer.size() - start - kHeaderSize < size) {
+        break;
+      }
+      const char* body = buffer.data() + start + 8;
+      if (Crc32c(body, size + 1) != crc) {
+        eof = true;  // corrupt record: treat as the end of the log
+        break;
+      }
+      fn(static_cast<WalRecordType>(static_cast<std::uint8_t>(body[0])),
+         std::string_view(body + 1, size));
+      start += kHeaderSize + size;
+      consumed += static_cast<off_t>(kHeaderSize + size);
+    }
+    if (eof) {
+      break;
+    }
+    buffer.erase(0, start);
+    start = 0;
+    ssize_t got = ::read(fd, chunk, sizeof(chunk));
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      *error = "read " + path + ": " + std::strerror(errno);
+      ::close(fd);
+      return false;
+    }
+    if (got == 0) {
+      break;
+    }
+    buffer.append(chunk, static_cast<std::size_t>(got));
+  }
+
+  if (st.st_size > consumed && !last) {
+    *error = "corrupt record in " + path + " at offset " + std::to_string(consumed);
+    ::close(fd);
+    return false;
+  }
+  if (st.st_size > consumed) {
+    if (::ftruncate(fd, consumed) != 0 || ::fdatasync(fd) != 0) {
+      *error = "truncate torn tail of " + path + ": " + std::strerror(errno);
+      ::close(fd);
+      return false;
+    }
+  }
+  ::close(fd);
+  return true;
+}
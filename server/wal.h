@@ -0,0 +1,210 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// When the log writer calls fdatasync.
+enum class SyncPolicy {
+  kEveryBatch,  // after every batch; an RPC is acked once its batch is on disk
+  kInterval,    // at most once per sync_interval; acked once written to the OS
+  kNone,        // never; acked once written to the OS
+};
+
+struct WalOptions {
+  // The log is a numbered series of files, dir/wal-NNNNNN.log.
+  std::string dir;
+  // A new segment is started once the current one reaches this size.
+  std::uint64_t segment_bytes = 64u << 20;
+  // Lowest number a new segment may take, so segments never go backwards
+  // past a position a snapshot recorded.
+  std::uint64_t first_segment = 1;
+  SyncPolicy sync_policy = SyncPolicy::kEveryBatch;
+  std::chrono::milliseconds sync_interval{10};
+  // Upper bound on records per write+sync; 0 means everything queued.
+  std::size_t max_batch_records = 0;
+};
+
+enum class WalRecordType : std::uint8_t {
+  kRegisterUser = 1,
+  kAddProduct = 2,
+  kPlaceBid = 3,
+};
+
+// Little-endian field encoding for record payloads.
+class RecordWriter {
+public:
+  explicit RecordWriter(std::string& out) : out_(out) {}
+
+  void PutU32(std::uint32_t value) { put(&value, sizeof(value)); }
+  void PutU64(std::uint64_t value) { put(&value, sizeof(value)); }
+  void PutI64(std::int64_t value) { put(&value, sizeof(value)); }
+  void PutString(std::string_view value) {
+    PutU32(static_cast<std::uint32_t>(value.size()));
+    out_.append(value.data(), value.size());
+  }
+
+private:
+  void put(const void* data, std::size_t size) {
+    out_.append(static_cast<const char*>(data), size);
+  }
+
+  std::string& out_;
+};
+
+class RecordReader {
+public:
+  explicit RecordReader(std::string_view in) : in_(in) {}
+
+  bool GetU32(std::uint32_t& value) { return get(&value, sizeof(value)); }
+  bool GetU64(std::uint64_t& value) { return get(&value, sizeof(value)); }
+  bool GetI64(std::int64_t& value) { return get(&value, sizeof(value)); }
+  bool GetString(std::string_view& value) {
+    std::uint32_t size;
+    if (!GetU32(size) || in_.size() < size) {
+      return false;
+    }
+    value = in_.substr(0, size);
+    in_.remove_prefix(size);
+    return true;
+  }
+
+private:
+  bool get(void* data, std::size_t size) {
+    if (in_.size() < size) {
+      return false;
+    }
+    std::memcpy(data, in_.data(), size);
+    in_.remove_prefix(size);
+    return true;
+  }
+
+  std::string_view in_;
+};
+
+// Append-only log of state mutations with group commit. Callers queue
+// records with Append() and block in WaitDurable(); a background writer
+// drains everything queued since its last pass with one write() and, per the
+// sync policy, one fdatasync(), then wakes every caller in that batch.
+//
+// On disk each record is [u32 payload size][u32 crc32c][u8 type][payload].
+// Records never span segments; each Open() starts a fresh segment.
+class WriteAheadLog {
+public:
+  using Lsn = std::uint64_t;
+
+  // A place in the log: a segment number and a byte offset within it.
+  // Tail() also fills in the last LSN handed out.
+  struct Position {
+    Lsn lsn = 0;
+    std::uint64_t segment = 0;
+    std::uint64_t offset = 0;
+  };
+
+  struct Stats {
+    std::uint64_t records = 0;
+    std::uint64_t batches = 0;
+    std::uint64_t syncs = 0;
+    std::uint64_t bytes = 0;
+  };
+
+  explicit WriteAheadLog(WalOptions options);
+  ~WriteAheadLog();
+
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+  // Starts a new segment after the last one in the directory and the
+  // writer thread. Replay first: Open() does not read existing segments.
+  bool Open(std::string* error);
+
+  // Queues a record and returns its log sequence number.
+  Lsn Append(WalRecordType type, std::string_view payload);
+  // Queues a record for each payload, in order, under one acquisition of
+  // the log's lock; returns the last one's LSN, or 0 if there are none.
+  Lsn Append(WalRecordType type, const std::vector<std::string>& payloads);
+
+  // Blocks until `lsn` has been written (and synced, for kEveryBatch).
+  // Returns false if the log hit an I/O error before that.
+  bool WaitDurable(Lsn lsn);
+
+  // Calls done(true) once `lsn` is durable, or done(false) if the log fails
+  // or closes first. Runs `done` right away if that is already settled,
+  // otherwise on the writer thread, which it must not block.
+  void WhenDurable(Lsn lsn, std::function<void(bool)> done);
+
+  // Where the next record will go, and the last LSN handed out: every record
+  // before this position has been appended.
+  Position Tail() const;
+
+  // Forces everything written so far to disk, whatever the sync policy.
+  bool Sync();
+
+  // Flushes and syncs everything queued, then stops the writer.
+  void Close();
+
+  Stats stats() const;
+
+  // Calls fn(type, payload) for each intact record in `dir` from `start`
+  // on, in order. A torn or corrupt tail on the last segment, as left by a
+  // crash mid-write, is truncated away; anywhere else it is an error. An
+  // empty directory is an empty log.
+  static bool Replay(const std::string& dir, const Position& start,
+                     const std::function<void(WalRecordType, std::string_view)>& fn,
+                     std::string* error);
+
+  static std::string SegmentPath(const std::string& dir, std::uint64_t segment);
+  // Segment numbers present in `dir`, ascending.
+  static std::vector<std::uint64_t> ListSegments(const std::string& dir);
+
+private:
+  static constexpr std::size_t kHeaderSize = 9;
+  static constexpr std::uint32_t kMaxRecordSize = 1u << 24;
+
+  void writerLoop();
+  // Runs the callbacks of waiters_ that are settled. Called by the writer
+  // with `lock` held; drops it while the callbacks run.
+  void notifyWaiters(std::unique_lock<std::mutex>& lock);
+  bool writeAll(const char* data, std::size_t size);
+  bool openSegment(std::uint64_t segment, std::string* error);
+  static bool replaySegment(const std::string& path, std::uint64_t start_offset, bool last,
+                            const std::function<void(WalRecordType, std::string_view)>& fn,
+                            std::string* error);
+
+  const WalOptions options_;
+  int fd_ = -1;
+  std::uint64_t fd_segment_ = 0;          // segment fd_ writes to; writer thread only
+  std::mutex fd_mutex_;                   // held to replace fd_, and by Sync()
+
+  mutable std::mutex mutex_;
+  std::condition_variable work_cond_;     // writer waits for records
+  std::condition_variable durable_cond_;  // appenders wait for their batch
+  std::string pending_;                   // encoded records not yet written
+  std::vector<std::size_t> pending_ends_; // end offset of each pending record
+  std::vector<std::uint64_t> pending_segments_;  // segment of each pending record
+  Lsn next_lsn_ = 1;
+  std::uint64_t tail_segment_ = 0;        // segment the next record goes to
+  std::uint64_t tail_offset_ = 0;         // and its offset there
+  Lsn durable_lsn_ = 0;
+  // The last record appended by a traced request; the writer traces the
+  // batch holding it.
+  Lsn traced_lsn_ = 0;
+  bool failed_ = false;
+  bool stopping_ = false;
+  bool writer_done_ = false;
+  std::multimap<Lsn, std::function<void(bool)>> waiters_;  // WhenDurable() callbacks
+  Stats stats_;
+
+  std::thread writer_;
+};
+
+#endif // WAL_H